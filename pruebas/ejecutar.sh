@@ -0,0 +1,377 @@
+#!/bin/bash
+##############################################################
+#	Pruebas de concurrencia, durabilidad y rendimiento (make test)
+#
+#	Cada ronda levanta el servidor sobre una copia de db_file.txt
+#	en un directorio temporal y lanza varios PS con -i que mezclan
+#	préstamos, devoluciones y renovaciones sobre los mismos ISBN.
+#	Las rondas con ThreadSanitizer (rp_tsan) detienen el servidor
+#	con SIGTERM en un momento al azar; la siguiente ronda parte del
+#	catálogo que quedó guardado. En cada ronda se revisa el volcado
+#	de -s contra las respuestas que recibieron los clientes:
+#	  - cada libro conserva sus ejemplares (sin repetidos),
+#	  - los prestados son los de antes más los préstamos
+#	    confirmados menos las devoluciones confirmadas (un
+#	    ejemplar prestado dos veces rompe la cuenta),
+#	  - ThreadSanitizer no reporta carreras.
+#	Después se mide el rendimiento con rp (la mejor de varias
+#	rondas) y se compara con pruebas/linea_base.txt, y la misma
+#	carga se repite con rp_contar, que aborta si una solicitud
+#	reserva memoria. Al final el catálogo se reparte en 4
+#	fragmentos con -R: una ronda completa con rp_tsan revisa el
+#	reparto por hash, y otra mata el servidor con SIGKILL y lo
+#	vuelve a iniciar, que rehace los cambios desde los diarios.
+#
+#	Uso: pruebas/ejecutar.sh [--actualizar-base]
+#	Variables: RONDAS (rondas con SIGTERM), SEMILLA (azar
+#	reproducible), COPIAS (PS por archivo de carga), MEDICIONES
+#	(rondas de rendimiento).
+##############################################################
+
+set -u
+
+DIR=$(cd "$(dirname "$0")" && pwd)
+RAIZ=$(dirname "$DIR")
+RONDAS=${RONDAS:-4}
+COPIAS=${COPIAS:-2}
+MEDICIONES=${MEDICIONES:-5}
+FRAGMENTOS=4
+SEMILLA=${SEMILLA:-$$}
+RANDOM=$SEMILLA
+BASE="$DIR/linea_base.txt"
+CARGAS=("$DIR"/carga*.txt)
+
+TRABAJO=$(mktemp -d /tmp/rp_pruebas.XXXXXX)
+PIPE="prueba$$"
+SERVIDOR=""
+fallos=0
+
+# Función que registra una falla sin detener las pruebas
+falla() {
+	echo "FALLA: $*"
+	fallos=$((fallos + 1))
+}
+
+# Función que detiene lo que quede en ejecución y borra los archivos temporales
+limpiar() {
+	if [ -n "$SERVIDOR" ]; then
+		kill -9 "$SERVIDOR" 2>/dev/null
+	fi
+	rm -rf "$TRABAJO" /tmp/"$PIPE"_*
+}
+trap limpiar EXIT
+
+# Función que resume un catálogo inicial (formato de db_file.txt): "isbn ejemplares prestados"
+resumirCatalogo() {
+	awk -F', ' '
+		NF == 3 && $1 !~ /^[0-9]+$/ { isbn = $2; ej[isbn] = $3 + 0; p[isbn] += 0 }
+		NF == 3 && $1 ~ /^[0-9]+$/ && $2 == "P" { p[isbn]++ }
+		END { for (i in ej) print i, ej[i], p[i] }' "$1" | sort
+}
+
+# Función que resume un volcado de -s: "isbn ejemplares listados prestados repetidos"
+resumirVolcado() {
+	awk -F', ' '
+		NR > 1 && NF == 3 && $3 ~ /:/ { ej[$2] = $3 + 0 }
+		NR > 1 && NF == 5 {
+			n[$2]++
+			p[$2] += ($4 == "P")
+			if (visto[$2 "," $3]++) rep[$2]++
+		}
+		END { for (i in ej) print i, ej[i], n[i] + 0, p[i] + 0, rep[i] + 0 }' "$1" | sort
+}
+
+# Función que suma por ISBN los cambios confirmados a los clientes: "isbn cambio P D"
+# (+1 por préstamo concedido, -1 por devolución recibida). P y D cuentan los préstamos y
+# devoluciones enviados que quedaron sin respuesta (a lo sumo uno por cliente).
+cambiosConfirmados() {
+	awk '
+		function pendiente() {
+			if (op == "P") sinP[isbn]++
+			if (op == "D") sinD[isbn]++
+			op = ""
+		}
+		FNR == 1 { pendiente() }
+		/^Operacion: / { op = substr($2, 1, 1); isbn = $NF; cambio[isbn] += 0; next }
+		/^Respuesta: / {
+			if (op == "P" && /se encuentra disponible, debe devolverlo/) cambio[isbn]++
+			if (op == "D" && /esta recibiendo el libro/) cambio[isbn]--
+			op = ""
+		}
+		END { pendiente(); for (i in cambio) print i, cambio[i], sinP[i] + 0, sinD[i] + 0 }' "$@" | sort
+}
+
+# Función que cuenta las respuestas recibidas (sin las de servidor ocupado)
+contarConfirmadas() {
+	cat "$@" | grep '^Respuesta: ' | grep -vc 'esta ocupado'
+}
+
+# Función que revisa el volcado contra el modelo y los cambios confirmados; deja en el
+# modelo el estado esperado para la ronda siguiente. Con holgura 1 (servidor matado con
+# SIGKILL) se aceptan además las solicitudes sin respuesta: el cambio pudo quedar en el
+# diario justo antes de la caída, sin que la respuesta llegara al cliente.
+verificarVolcado() {
+	local ronda=$1 volcado=$2 modelo=$3 cambios=$4 holgura=${5:-0}
+	if [ ! -s "$volcado" ]; then
+		falla "$ronda: el servidor no escribio el volcado de -s"
+		return
+	fi
+	resumirVolcado "$volcado" > "$TRABAJO/resumen.txt"
+	awk -v ronda="$ronda" -v holgura="$holgura" '
+		FILENAME == ARGV[1] { ej[$1] = $2; p[$1] = $3; next }
+		FILENAME == ARGV[2] { cambio[$1] = $2; sinP[$1] = $3; sinD[$1] = $4; next }
+		{ vej[$1] = $2; vlist[$1] = $3; vp[$1] = $4; vrep[$1] = $5 }
+		END {
+			for (i in ej) {
+				esperado = p[i] + cambio[i]
+				if (holgura && vp[i] >= esperado - sinD[i] && vp[i] <= esperado + sinP[i])
+					esperado = vp[i]
+				if (!(i in vej)) { print "FALLA: " ronda ": el libro " i " no esta en el volcado"; continue }
+				if (vej[i] != ej[i] || vlist[i] != ej[i])
+					print "FALLA: " ronda ": el libro " i " tiene " vej[i] " ejemplares (" vlist[i] " listados), se esperaban " ej[i]
+				if (vrep[i] > 0)
+					print "FALLA: " ronda ": el libro " i " tiene numeros de ejemplar repetidos"
+				if (esperado < 0 || esperado > ej[i])
+					print "FALLA: " ronda ": el libro " i " quedaria con " esperado " prestados de " ej[i] " (prestamo doble)"
+				if (vp[i] != esperado)
+					print "FALLA: " ronda ": el libro " i " tiene " vp[i] " prestados, las respuestas confirmadas dan " esperado
+				print i, ej[i], esperado > "/dev/stderr"
+			}
+		}' "$modelo" "$cambios" "$TRABAJO/resumen.txt" 2> "$TRABAJO/modelo.nuevo" > "$TRABAJO/fallas.txt"
+	while read -r linea; do
+		falla "${linea#FALLA: }"
+	done < "$TRABAJO/fallas.txt"
+	sort "$TRABAJO/modelo.nuevo" > "$modelo"
+}
+
+# Función que levanta el servidor (binario y archivo del volcado) y espera su pipe
+iniciarServidor() {
+	local binario=$1 volcado=$2 registro=$3
+	rm -f /tmp/"$PIPE"_CS
+	(cd "$TRABAJO" && exec "$binario" -p "$PIPE" -f db_file.txt -s "$volcado" < /dev/null > "$registro" 2>&1) &
+	SERVIDOR=$!
+	for _ in $(seq 100); do
+		[ -p /tmp/"$PIPE"_CS ] && return 0
+		kill -0 "$SERVIDOR" 2>/dev/null || break
+		sleep 0.1
+	done
+	falla "el servidor $(basename "$binario") no inicio"
+	return 1
+}
+
+# Función que detiene el servidor con SIGTERM y revisa que termine bien
+detenerServidor() {
+	local nombre=$1
+	kill -TERM "$SERVIDOR" 2>/dev/null
+	for _ in $(seq 300); do
+		kill -0 "$SERVIDOR" 2>/dev/null || break
+		sleep 0.1
+	done
+	if kill -0 "$SERVIDOR" 2>/dev/null; then
+		falla "$nombre: el servidor no termino 30 s despues de SIGTERM"
+		kill -9 "$SERVIDOR"
+	fi
+	wait "$SERVIDOR"
+	local estado=$?
+	SERVIDOR=""
+	if [ "$estado" -ne 0 ]; then
+		falla "$nombre: el servidor termino con estado $estado"
+	fi
+}
+
+# Función que lanza COPIAS clientes por cada archivo de carga; deja los PID en CLIENTES
+lanzarClientes() {
+	local ronda=$1
+	CLIENTES=()
+	for carga in "${CARGAS[@]}"; do
+		for c in $(seq "$COPIAS"); do
+			(cd "$TRABAJO" && exec timeout -k 1 120 stdbuf -oL "$RAIZ/ps" -p "$PIPE" -i "$carga" < /dev/null \
+				> "$TRABAJO/$ronda.$(basename "$carga" .txt).$c.log" 2>&1) &
+			CLIENTES+=($!)
+		done
+	done
+}
+
+# Función que espera a los clientes hasta un plazo en segundos y termina los que queden
+esperarClientes() {
+	local plazo=$1
+	for _ in $(seq $((plazo * 10))); do
+		local vivos=0
+		for pid in "${CLIENTES[@]}"; do
+			kill -0 "$pid" 2>/dev/null && vivos=1
+		done
+		[ "$vivos" -eq 0 ] && break
+		sleep 0.1
+	done
+	# timeout pasa SIGTERM al PS (con SIGKILL el PS quedaría huérfano) y lo mata al segundo
+	for pid in "${CLIENTES[@]}"; do
+		kill -TERM "$pid" 2>/dev/null
+	done
+	for pid in "${CLIENTES[@]}"; do
+		wait "$pid" 2>/dev/null
+	done
+}
+
+# Función que revisa que cada cliente de una ronda completa recibiera todas sus respuestas
+# (el 'Q' de un cliente no debe terminar el servicio de los demás)
+verificarClientesCompletos() {
+	local ronda=$1
+	for carga in "${CARGAS[@]}"; do
+		local esperadas
+		esperadas=$(grep -c . "$carga")
+		for c in $(seq "$COPIAS"); do
+			local registro="$TRABAJO/$ronda.$(basename "$carga" .txt).$c.log"
+			local recibidas
+			recibidas=$(grep -c '^Respuesta: ' "$registro")
+			if [ "$recibidas" -ne "$esperadas" ]; then
+				falla "$ronda: $(basename "$registro") recibio $recibidas de $esperadas respuestas"
+			fi
+		done
+	done
+}
+
+# Función que ordena un volcado de -s por ISBN, sin cambiar el orden dentro de cada libro
+# (el volcado recorre los fragmentos en orden, así que depende de cuántos haya)
+ordenarVolcado() {
+	awk -F', ' 'NF == 3 && $3 ~ /:/ { isbn = $2 } NR > 1 { print isbn "\t" $0 }' "$1" | sort -s -t$'\t' -k1,1
+}
+
+# Función que revisa que el catálogo guardado en una ronda se vuelva a cargar igual
+recarga() {
+	local anterior=$1 nombre=$2
+	if iniciarServidor "$RAIZ/rp" "$nombre.volcado.txt" "$TRABAJO/$nombre.servidor.log"; then
+		detenerServidor "$nombre"
+		ordenarVolcado "$TRABAJO/$anterior.volcado.txt" > "$TRABAJO/$anterior.ordenado.txt"
+		ordenarVolcado "$TRABAJO/$nombre.volcado.txt" > "$TRABAJO/$nombre.ordenado.txt"
+		if ! cmp -s "$TRABAJO/$anterior.ordenado.txt" "$TRABAJO/$nombre.ordenado.txt"; then
+			falla "$nombre: el catalogo guardado no coincide con el volcado de $anterior"
+			diff "$TRABAJO/$anterior.ordenado.txt" "$TRABAJO/$nombre.ordenado.txt" | head -20
+		fi
+	fi
+}
+
+# Función que ejecuta una ronda: si se da una espera en segundos envía la señal (SIGTERM
+# si no se indica otra) en ese momento, si no espera a que todos los clientes terminen.
+# Con SIGKILL el servidor se vuelve a iniciar y se detiene sin solicitudes: el volcado
+# muestra lo que se recuperó de los archivos y diarios. Deja la duración en DURACION.
+ronda() {
+	local binario=$1 nombre=$2 espera=${3:-} senal=${4:-TERM}
+	local volcado="$nombre.volcado.txt"
+	iniciarServidor "$binario" "$volcado" "$TRABAJO/$nombre.servidor.log" || return
+	local inicio fin
+	inicio=$(date +%s.%N)
+	lanzarClientes "$nombre"
+	if [ -n "$espera" ] && [ "$senal" = KILL ]; then
+		sleep "$espera"
+		kill -KILL "$SERVIDOR"
+		wait "$SERVIDOR" 2>/dev/null
+		SERVIDOR=""
+		esperarClientes 1
+		rm -f "$TRABAJO/$volcado"
+		iniciarServidor "$binario" "$volcado" "$TRABAJO/$nombre.reinicio.log" || return
+		detenerServidor "$nombre"
+	elif [ -n "$espera" ]; then
+		sleep "$espera"
+		detenerServidor "$nombre"
+		esperarClientes 10
+	else
+		wait "${CLIENTES[@]}"  # Cada PS termina con su 'Q' (o a los 120 s)
+		fin=$(date +%s.%N)
+		DURACION=$(awk -v a="$inicio" -v b="$fin" 'BEGIN { print b - a }')
+		verificarClientesCompletos "$nombre"
+		detenerServidor "$nombre"
+	fi
+	if grep -q 'ThreadSanitizer' "$TRABAJO/$nombre.servidor.log"; then
+		falla "$nombre: ThreadSanitizer reporto carreras:"
+		grep -A12 'WARNING: ThreadSanitizer' "$TRABAJO/$nombre.servidor.log" | head -40
+	fi
+	cambiosConfirmados "$TRABAJO/$nombre".carga*.log > "$TRABAJO/$nombre.cambios.txt"
+	verificarVolcado "$nombre" "$TRABAJO/$volcado" "$TRABAJO/modelo.txt" "$TRABAJO/$nombre.cambios.txt" \
+		"$([ "$senal" = KILL ] && echo 1)"
+	echo "$nombre: $(contarConfirmadas "$TRABAJO/$nombre".carga*.log) respuestas confirmadas"
+}
+
+for binario in rp ps rp_tsan rp_contar; do
+	if [ ! -x "$RAIZ/$binario" ]; then
+		echo "Falta $binario: compile con make all rp_tsan rp_contar"
+		exit 1
+	fi
+done
+
+echo "Semilla: $SEMILLA (repetir con SEMILLA=$SEMILLA)"
+cp "$RAIZ/db_file.txt" "$TRABAJO/db_file.txt"
+resumirCatalogo "$TRABAJO/db_file.txt" > "$TRABAJO/modelo.txt"
+
+# Rondas con ThreadSanitizer: la primera completa y las demás cortadas con SIGTERM en un
+# momento al azar dentro de lo que duró la primera
+DURACION=1
+ronda "$RAIZ/rp_tsan" tsan0
+for r in $(seq "$RONDAS"); do
+	espera=$(awk -v d="$DURACION" -v r=$RANDOM 'BEGIN { printf "%.3f", d * r / 32768 }')
+	echo "tsan$r: SIGTERM a los $espera s"
+	ronda "$RAIZ/rp_tsan" "tsan$r" "$espera"
+done
+
+# El catálogo guardado se vuelve a cargar igual: un arranque sin solicitudes no lo cambia
+recarga tsan$RONDAS recarga
+
+# Rendimiento: rondas completas con rp; se compara la mejor con la línea base (una sola
+# ronda dura menos de un segundo y varía mucho con la carga de la máquina)
+ops=0
+duracionRp=1
+for m in $(seq "$MEDICIONES"); do
+	ronda "$RAIZ/rp" "rendimiento$m"
+	confirmadas=$(contarConfirmadas "$TRABAJO"/rendimiento$m.carga*.log)
+	medida=$(awk -v c="$confirmadas" -v d="$DURACION" 'BEGIN { print c / d }')
+	printf 'rendimiento%d: %.0f operaciones por segundo\n' "$m" "$medida"
+	if awk -v a="$medida" -v b="$ops" 'BEGIN { exit !(a > b) }'; then
+		ops=$medida
+		duracionRp=$DURACION
+	fi
+done
+printf 'rendimiento: %.0f operaciones por segundo (la mejor de %d rondas)\n' "$ops" "$MEDICIONES"
+if [ "${1:-}" = "--actualizar-base" ]; then
+	umbral=$(awk '$1 == "umbral_porcentaje" { print $2 }' "$BASE" 2>/dev/null)
+	{
+		echo "# Línea base de pruebas/ejecutar.sh (COPIAS=$COPIAS, la mejor de $MEDICIONES rondas): operaciones por segundo y caída máxima permitida"
+		printf 'operaciones_por_segundo %.0f\n' "$ops"
+		echo "umbral_porcentaje ${umbral:-30}"
+	} > "$BASE"
+	echo "Línea base actualizada"
+else
+	base=$(awk '$1 == "operaciones_por_segundo" { print $2 }' "$BASE")
+	umbral=$(awk '$1 == "umbral_porcentaje" { print $2 }' "$BASE")
+	minimo=$(awk -v b="$base" -v u="$umbral" 'BEGIN { print b * (100 - u) / 100 }')
+	printf 'linea base: %d operaciones por segundo, minimo %.0f (-%d%%)\n' "$base" "$minimo" "$umbral"
+	if awk -v o="$ops" -v m="$minimo" 'BEGIN { exit !(o < m) }'; then
+		falla "rendimiento: $(printf '%.0f' "$ops") operaciones por segundo, por debajo del minimo"
+	fi
+fi
+
+# Sin reservas de memoria por solicitud: la carga de rendimiento con rp_contar
+ronda "$RAIZ/rp_contar" contar
+if grep -q 'reservas de memoria' "$TRABAJO/contar.servidor.log"; then
+	falla "contar: $(grep -m1 'reservas de memoria' "$TRABAJO/contar.servidor.log")"
+fi
+
+# Catálogo fragmentado: el reparto con -R conserva el catálogo, una ronda completa con
+# rp_tsan envía cada ISBN a su fragmento, y una ronda cortada con SIGKILL se recupera desde
+# los diarios. El SIGKILL llega en un momento al azar entre la mitad y una vez y media de lo
+# que duró la mejor ronda de rendimiento: los clientes ya empezaron y, aunque hayan
+# terminado, sus cambios solo están en los diarios (el punto de control tarda 5 s).
+if (cd "$TRABAJO" && "$RAIZ/rp" -R -f db_file.txt -k "$FRAGMENTOS" > reparto.log 2>&1); then
+	recarga contar reparto
+	ronda "$RAIZ/rp_tsan" fragmentos
+	espera=$(awk -v d="$duracionRp" -v r=$RANDOM 'BEGIN { printf "%.3f", d * (0.5 + r / 32768) }')
+	echo "caida: SIGKILL a los $espera s"
+	ronda "$RAIZ/rp" caida "$espera" KILL
+else
+	falla "reparto: no se pudo repartir el catalogo en $FRAGMENTOS fragmentos"
+	cat "$TRABAJO/reparto.log"
+fi
+
+if [ "$fallos" -ne 0 ]; then
+	echo "$fallos fallas"
+	exit 1
+fi
+echo "Todas las pruebas pasaron"
@@ -9,6 +9,9 @@
 *   o automatizadas (lectura desde archivo con -i). Se comunica
 *   con el servidor a través de pipes FIFO, muestra respuestas
 *   recibidas y gestiona la terminación ordenada del servicio.
+*   Recibe las respuestas por un pipe propio y además escucha un
+*   pipe de avisos por el que el servidor notifica los préstamos
+*   de libros reservados.
 **************************************************************/
 
 #include <stdio.h>
@@ -16,16 +19,28 @@
 #include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <poll.h>
 #include <sys/stat.h>
 
 // Estructura para almacenar la solicitud de operación
 typedef struct{
-	char operacion;   // Tipo de operación ('D' para devolver, 'R' para renovar, 'P' para pedir, 'Q' para salir)
+	char operacion;   // Tipo de operación ('D' para devolver, 'R' para renovar, 'P' para pedir, 'E' para reservar, 'C' para consultar, 'Q' para salir)
 	char nombre[30];  // Nombre del libro
 	char isbn[30];	// ISBN del libro
+	int cliente;      // PID del cliente (PS) que envía la solicitud
+	char clase;       // Clase del cliente ('I' interactivo, 'L' lote con -i)
 } Requerimiento;
 
+char claseCliente = 'I'; // Clase con la que se envían las solicitudes (lote mientras se lee -i)
+
+int fd_avisos = -1; // Pipe por el que el servidor avisa los préstamos de libros reservados
+char fifo_avisos[64]; // Nombre del pipe de avisos
+char fifo_SC[64];     // Nombre del pipe por el que el servidor responde a este cliente
+char fifo_CS[50];     // Nombre del pipe por el que se envían las solicitudes
+
 void mostrarMenu();
+void revisarAvisos();
+void cerrarPipesPropios();
 void enviarRequerimiento(int fd_CS, int fd_SC, char operacion, const char *nombre, const char *isbn);
 void leerArchivo(const char *fileDatos, int fd_CS, int fd_SC);
 int manejarOtraOpcion(int fd_CS, int fd_SC);
@@ -64,10 +79,10 @@ int main(int argc, char *argv[]){
 		exit(1);
 	}
 
-	// Variables para las rutas de los pipes FIFO
-	char fifo_SC[50], fifo_CS[50];
+	// Rutas de los pipes FIFO: el de solicitudes es común y el de respuestas es propio
+	// de este cliente (/tmp/<pipe>_R<pid>), así las respuestas no se cruzan entre clientes
 	snprintf(fifo_CS, sizeof(fifo_CS), "/tmp/%s_CS", pipeReceptor);
-	snprintf(fifo_SC, sizeof(fifo_SC), "/tmp/%s_SC", pipeReceptor);
+	snprintf(fifo_SC, sizeof(fifo_SC), "/tmp/%s_R%d", pipeReceptor, (int)getpid());
 
 	// Abre el pipe de escritura (Client-Server) para enviar datos
 	int fd_CS = open(fifo_CS, O_WRONLY);
@@ -76,14 +91,22 @@ int main(int argc, char *argv[]){
 		exit(1);
 	}
 
-	// Abre el pipe de lectura (Server-Client) para recibir datos
-	int dummy = open(fifo_SC, O_WRONLY | O_NONBLOCK);  // Se abre solo para verificar si existe
-	int fd_SC = open(fifo_SC, O_RDONLY);  // Abre el pipe para lectura
+	// Crea y abre el pipe de respuestas (Server-Client). Se abre en lectura/escritura para
+	// que la apertura no espere al servidor, que lo abre solo al responder.
+	mkfifo(fifo_SC, S_IFIFO|0640);
+	int fd_SC = open(fifo_SC, O_RDWR);
 	if (fd_SC == -1) {
 		perror("Error abriendo fifo_SC");
 		exit(1);
 	}
-	if (dummy != -1) close(dummy);  // Si dummy se abre correctamente, se cierra
+
+	// Crea y abre el pipe de avisos de este cliente (/tmp/<pipe>_A<pid>)
+	snprintf(fifo_avisos, sizeof(fifo_avisos), "/tmp/%s_A%d", pipeReceptor, (int)getpid());
+	mkfifo(fifo_avisos, S_IFIFO|0640);
+	fd_avisos = open(fifo_avisos, O_RDONLY | O_NONBLOCK);
+	if (fd_avisos == -1) {
+		perror("Error abriendo fifo de avisos");
+	}
 
 	// Imprime un mensaje de bienvenida
 	printf("Bienvenido al sistema de prestamo de libros NSQK\n\n");
@@ -97,6 +120,9 @@ int main(int argc, char *argv[]){
 
 	while(1){
 
+		// Muestra los avisos de libros reservados que hayan llegado
+		revisarAvisos();
+
 		// Menú para que el usuario seleccione la operación que desea realizar
 		mostrarMenu();
 
@@ -123,6 +149,10 @@ int main(int argc, char *argv[]){
 				op = 'R';  // Renovar un libro
 			}else if(strcmp(buffer, "3") == 0){
 				op = 'P';  // Solicitar préstamo de un libro
+			}else if(strcmp(buffer, "4") == 0){
+				op = 'E';  // Reservar un libro no disponible (lista de espera)
+			}else if(strcmp(buffer, "5") == 0){
+				op = 'C';  // Consultar la disponibilidad de un libro sin pedirlo
 			}else{
 				perror("Entrada invalida");
 				continue;
@@ -153,15 +183,13 @@ int main(int argc, char *argv[]){
 			// Escribe la solicitud en el pipe
 			enviarRequerimiento(fd_CS, fd_SC, op, nombre, isbn);
 		} else {
-			// Si se selecciona "0" para salir, envía una señal de salida (Q)
-			Requerimiento req = {'Q', "-", "-"};
-			ssize_t bytes_written = write(fd_CS, &req, sizeof(Requerimiento));
-			if(bytes_written == -1){
-				perror("Error al escribir en el FIFO");
-			}
+			// Si se selecciona "0" para salir, envía una señal de salida (Q); el PID que
+			// lleva la solicitud permite al servidor cancelar sus reservas y cerrar su sesión
+			enviarRequerimiento(fd_CS, fd_SC, 'Q', "-", "-");
 			printf("\nGracias por usar nuestro sistema\n");
 			close(fd_CS);
 			close(fd_SC);
+			cerrarPipesPropios();
 			break;  // Sale del ciclo principal
 		}
 
@@ -179,6 +207,8 @@ void mostrarMenu() {
     printf("1. Devolver un libro\n");
     printf("2. Renovar un libro\n");
     printf("3. Solicitar prestamo de un libro\n");
+    printf("4. Reservar un libro no disponible\n");
+    printf("5. Consultar disponibilidad de un libro\n");
     printf("0. Salir\n\n");
     printf("Opcion: ");
 }
@@ -188,6 +218,8 @@ void enviarRequerimiento(int fd_CS, int fd_SC, char operacion, const char *nombr
     Requerimiento req = {operacion};
     strcpy(req.nombre, nombre);
     strcpy(req.isbn, isbn);
+    req.cliente = (int)getpid();
+    req.clase = claseCliente;
 
     // Escribe la solicitud en el pipe
 	ssize_t bytes_written = write(fd_CS, &req, sizeof(Requerimiento));
@@ -198,20 +230,56 @@ void enviarRequerimiento(int fd_CS, int fd_SC, char operacion, const char *nombr
         exit(1);
     }
 
-    char *msg = (char *)malloc(256 * sizeof(char));
-    memset(msg, 0, 256);
+    // Espera la respuesta, que llega cuando el servidor aplica la solicitud. Cada segundo
+    // sin respuesta verifica que el servidor siga leyendo solicitudes.
+    struct pollfd espera = {fd_SC, POLLIN, 0};
+    while (poll(&espera, 1, 1000) == 0) {
+        int fd_vivo = open(fifo_CS, O_WRONLY | O_NONBLOCK);  // Falla si nadie lee el pipe
+        if (fd_vivo == -1) {
+            printf("\nEl servidor no responde\n");
+            close(fd_CS);
+            close(fd_SC);
+            cerrarPipesPropios();
+            exit(1);
+        }
+        close(fd_vivo);
+    }
+
+    char msg[257] = "";
 	// Lee la respuesta del servidor desde el pipe
     int read_bytes = read(fd_SC, msg, 256);
     if (read_bytes == -1) {
         perror("Error al leer del FIFO");
         close(fd_SC);
         close(fd_CS);
-        free(msg);
         exit(1);
     }
-    msg[strlen(msg)] = '\0';
     printf("\nRespuesta: %s\n", msg);
-    free(msg);
+}
+
+// Función que muestra los avisos pendientes enviados por el servidor
+void revisarAvisos() {
+    if (fd_avisos == -1) {
+        return;
+    }
+    char aviso[256];
+    int read_bytes;
+    // El pipe no bloquea: si no hay avisos read devuelve -1 (EAGAIN) o 0
+    while ((read_bytes = read(fd_avisos, aviso, sizeof(aviso) - 1)) > 0) {
+        aviso[read_bytes] = '\0';
+        printf("\n%s\n", aviso);
+    }
+}
+
+// Función que cierra y elimina los pipes propios del cliente (avisos y respuestas)
+void cerrarPipesPropios() {
+    if (fd_avisos != -1) {
+        revisarAvisos();
+        close(fd_avisos);
+        unlink(fifo_avisos);
+        fd_avisos = -1;
+    }
+    unlink(fifo_SC);
 }
 
 // Función que lee el archivo de datos y envía las solicitudes al servidor
@@ -226,6 +294,7 @@ void leerArchivo(const char *fileDatos, int fd_CS, int fd_SC) {
 
     Requerimiento req;
     char linea[100];
+    claseCliente = 'L';  // Las solicitudes leídas del archivo se atienden como lote
 	// Lee cada línea del archivo de datos y envía la solicitud al servidor
     while (fgets(linea, sizeof(linea), entrada)) {
         if (linea[strlen(linea) - 1] == '\n') {
@@ -234,16 +303,19 @@ void leerArchivo(const char *fileDatos, int fd_CS, int fd_SC) {
         if (sscanf(linea, "%c, %29[^,], %29[^,]\n", &req.operacion, req.nombre, req.isbn) == 3) {
             printf("Operacion: %c, Nombre: %s, ISBN: %s", req.operacion, req.nombre, req.isbn);
             enviarRequerimiento(fd_CS, fd_SC, req.operacion, req.nombre, req.isbn);
+            revisarAvisos();
             if (req.operacion == 'Q') {
                 printf("\nGracias por usar nuestro sistema\n");
                 fclose(entrada);
                 close(fd_CS);
                 close(fd_SC);
+                cerrarPipesPropios();
                 exit(0);
             }
         }
     }
     fclose(entrada);
+    claseCliente = 'I';
 }
 
 // Función que maneja la opción de realizar otra solicitud
@@ -260,14 +332,11 @@ int manejarOtraOpcion(int fd_CS, int fd_SC) {
             buffer[strlen(buffer) - 1] = '\0';
         }
         if (strcmp(buffer, "n") == 0) {		// Si el usuario no quiere continuar, envía una señal de salida (Q)
-            Requerimiento req = {'Q', "-", "-"};
-            ssize_t bytes_written = write(fd_CS, &req, sizeof(Requerimiento));
-            if (bytes_written == -1) {
-                perror("Error al escribir en el FIFO");
-            }
+            enviarRequerimiento(fd_CS, fd_SC, 'Q', "-", "-");
             printf("\nGracias por usar nuestro sistema\n");
             close(fd_CS);
             close(fd_SC);
+            cerrarPipesPropios();
             return 0;
         } else if (strcmp(buffer, "s") == 0) {
             valido = 0;
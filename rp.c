@@ -10,6 +10,21 @@
 *   procesar solicitudes de forma concurrente, actualiza la base
 *   de datos de libros al cambiar estados y fechas, y soporta comandos
 *   administrativos como generación de reportes ('r') o terminación ('s').
+*   El catálogo se mantiene en memoria particionado en fragmentos
+*   por hash del ISBN; cada fragmento tiene su propio archivo,
+*   diario de cambios e hilo de persistencia. Con -F el programa
+*   corre como seguidor de solo lectura: sigue los diarios del
+*   servidor principal y atiende consultas y reportes. Los libros
+*   sin ejemplares disponibles admiten reservas ('E'): al devolverse
+*   un ejemplar se presta al primero de la lista de espera y se le
+*   avisa por su pipe de avisos. Con el comando 'a archivo' (u
+*   operación 'A') se ingresan libros y ejemplares nuevos al
+*   catálogo sin detener el servidor. Los préstamos, reservas,
+*   devoluciones y renovaciones pasan por un planificador con una
+*   cola por cliente (round-robin por déficit) que atiende primero
+*   a los clientes interactivos, y se responden por el pipe de
+*   respuestas de cada cliente al aplicarse; el comando 'm' muestra
+*   la espera de cada cliente.
 **************************************************************/
 
 #include <stdio.h>
@@ -22,52 +37,219 @@
 #include <pthread.h>
 #include <errno.h>
 #include <semaphore.h>
+#include <sys/time.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <poll.h>
 
-#define N 10 // Tamaño del buffer circular
+#define N 10 // Tamaño del buffer circular de cada sesión
+#define MAX_SESIONES 32 // Clientes con cola propia en el planificador
+#define QUANTUM 4 // Solicitudes que atiende una sesión por turno (round-robin por déficit)
+#define CUBETAS 32 // Cubetas del histograma de espera (potencias de 2 en microsegundos)
+#define SESION_INACTIVA 60 // Segundos sin solicitudes después de los que otra sesión puede tomar el lugar
 
 // Estructura para almacenar la solicitud de operación
 typedef struct{
-	char operacion;   // Tipo de operación ('D' para devolver, 'R' para renovar, 'P' para pedir, 'Q' para salir)
+	char operacion;   // Tipo de operación ('D' para devolver, 'R' para renovar, 'P' para pedir, 'E' para reservar, 'C' para consultar, 'Q' para salir)
 	char nombre[30];  // Nombre del libro
 	char isbn[30];	// ISBN del libro
+	int cliente;      // PID del cliente (PS) que envía la solicitud
+	char clase;       // Clase del cliente ('I' interactivo, 'L' lote con -i)
 } Requerimiento;
 
-// Buffer circular para almacenar las solicitudes
-Requerimiento buffer[N];
-int in, out; // Índices para insertar y extraer de la cola
-int continuar = 1; // Variable de control para continuar la ejecución del servidor
+// Estructura para las métricas de espera en cola del planificador
+typedef struct{
+	long long atendidas;             // Solicitudes atendidas
+	long long esperaTotal;           // Suma de las esperas en microsegundos
+	long long esperaMax;             // Espera máxima en microsegundos
+	long long histograma[CUBETAS];   // Cubeta b: espera menor a 2^b microsegundos
+} Metricas;
 
-// Semáforos para sincronización de la cola
-sem_t vacio, lleno, mutex;
+// Estructura para la cola de un cliente (sesión) en el planificador
+typedef struct{
+	int cliente;                // PID del cliente (0 = sesión libre)
+	char clase;                 // Clase del cliente ('I' interactivo, 'L' lote)
+	Requerimiento buffer[N];    // Buffer circular de solicitudes de la sesión
+	long long llegada[N];       // Momento de llegada de cada solicitud (microsegundos)
+	int in, out, cantidad;      // Índices para insertar y extraer de la cola, y solicitudes pendientes
+	int deficit;                // Solicitudes que aún puede atender en su turno
+	long long ultimaActividad;  // Momento de la última solicitud del cliente (microsegundos)
+	Metricas metricas;          // Espera en cola de las solicitudes de la sesión
+} Sesion;
+
+Sesion sesiones[MAX_SESIONES]; // Sesiones del planificador
+int turno[2]; // Próxima sesión a revisar para cada clase (0 interactiva, 1 lote)
+Metricas metricasClase[2]; // Espera en cola por clase (0 interactiva, 1 lote)
+atomic_int continuar = 1; // Variable de control para continuar la ejecución del servidor (la leen todos los hilos)
+int seguidor = 0; // Indica si el servidor corre como seguidor de solo lectura (-F)
+char nombrePipe[32]; // Nombre del pipe receptor, usado para construir los pipes de avisos
+
+// Semáforos para sincronización del planificador (el lector nunca espera espacio: si la
+// cola de un cliente está llena su solicitud se rechaza)
+sem_t lleno, mutex;
 
 // Función que maneja las solicitudes en el servidor
 void* manejoRequerimientos(void*);
 // Función que maneja los comandos en la consola
 void* manejoComandos(void*);
+// Función que maneja SIGINT y SIGTERM
+void detenerServidor(int);
+// Funciones del planificador de solicitudes
+int encolarRequerimiento(Requerimiento req);
+void terminarSesion(int cliente);
+int extraerRequerimiento(Requerimiento *req);
+void mostrarMetricas();
+
+#define MAX_FRAGMENTOS 64 // Número máximo de fragmentos del catálogo
+#define MAX_RESERVAS 256  // Reservas preasignadas por fragmento (listas de espera)
+#define UMBRAL_DIARIO 1000 // Cambios en el diario que provocan un punto de control
+#define INTERVALO_PUNTO 5  // Segundos máximos entre un cambio y su punto de control
+// Primera línea de cada diario: posición del fragmento, cantidad de fragmentos del catálogo
+// y libros y ejemplares que tiene el archivo del fragmento
+#define ENCABEZADO_DIARIO "# fragmento %d de %d libros %d ejemplares %d\n"
+
+// Estructura para almacenar un ejemplar de un libro
+typedef struct{
+	int numero;     // Número del ejemplar
+	char estado;    // Estado del ejemplar ('D' disponible, 'P' prestado)
+	char fecha[12]; // Fecha del último cambio o de entrega
+} Ejemplar;
+
+// Estructura para almacenar una reserva en la lista de espera de un libro
+typedef struct Reserva{
+	int cliente;               // PID del cliente que espera el libro
+	struct Reserva *siguiente; // Siguiente reserva en la lista de espera
+} Reserva;
+
+// Estructura para almacenar un libro con sus ejemplares
+typedef struct{
+	char nombre[30];  // Nombre del libro
+	char isbn[30];    // ISBN del libro
+	int ejemplares;   // Cantidad de ejemplares
+	Ejemplar *lista;  // Ejemplares del libro
+	Reserva *primera; // Primera reserva de la lista de espera (FIFO)
+	Reserva *ultima;  // Última reserva de la lista de espera
+} Libro;
+
+// Estructura para la disponibilidad de un libro en la vista de consultas
+typedef struct{
+	char isbn[30];              // ISBN del libro (no cambia después de publicada la vista)
+	atomic_int disponibles;     // Ejemplares disponibles
+	atomic_int total;           // Cantidad de ejemplares
+	atomic_int proximaEntrega;  // Fecha de entrega más próxima como aaaammdd (0 si no hay préstamos)
+} Disponibilidad;
 
-// Estructura para almacenar los datos de la base de datos (archivo)
+// Estructura para la vista de solo lectura de un fragmento (consultas 'C' sin candado)
 typedef struct{
-	FILE *archivo;	// Apuntador al archivo de base de datos
-	char file_name[64]; // Nombre del archivo
-	char isbnLibro[100]; // ISBN del libro
-	char nombreLibro[100]; // Nombre del libro
-} Archivo;
+	Disponibilidad *libros; // Disponibilidad de cada libro, en el mismo orden que el fragmento
+	int *indice;            // Tabla hash ISBN -> posición + 1 (0 = vacía)
+	int tamIndice;          // Tamaño de la tabla hash (potencia de 2)
+	int numLibros;          // Cantidad de libros de la vista
+} Vista;
 
-Archivo database; // Instancia de la estructura Archivo
+// Estructura para almacenar un fragmento del catálogo (archivo + diario + hilo)
+typedef struct{
+	char file_name[80];     // Nombre del archivo del fragmento
+	char diario_name[96];   // Nombre del diario de cambios del fragmento
+	FILE *diario;           // Apuntador al diario de cambios (de lectura en modo seguidor)
+	char bufferDiario[BUFSIZ]; // Búfer propio del diario, para que stdio no lo reserve al escribir
+	ino_t inodo;            // Inodo del diario que se está siguiendo (modo seguidor)
+	Libro *libros;          // Libros del fragmento
+	int *indice;            // Tabla hash ISBN -> posición + 1 (0 = vacía)
+	int tamIndice;          // Tamaño de la tabla hash (potencia de 2)
+	Reserva *reservas;      // Bloque de reservas preasignado al abrir el catálogo
+	Reserva *libres;        // Lista de reservas libres del bloque
+	int numLibros;          // Cantidad de libros en el fragmento
+	int capacidad;          // Capacidad reservada del arreglo de libros
+	int sucio;              // Indica si hay cambios sin guardar en el archivo
+	int lineasDiario;       // Cambios anotados en el diario desde el último punto de control
+	long bytesDiario;       // Tamaño del diario (los cambios posteriores a un punto de control empiezan aquí)
+	int terminar;           // Indica al hilo de persistencia que debe terminar
+	_Atomic(Vista *) vista; // Vista de consultas: se lee sin candado y se reemplaza con el candado tomado
+	atomic_uint secuencia;  // Contador del seqlock de la vista (impar mientras se actualiza un libro)
+	pthread_mutex_t candado;  // Acceso exclusivo al fragmento
+	pthread_mutex_t candadoPunto; // Un solo punto de control a la vez (hilo de persistencia o ingreso); se toma antes que candado
+	pthread_cond_t cambios;   // Avisa al hilo de persistencia que hay cambios
+	pthread_t hilo;           // Hilo de persistencia del fragmento
+} Fragmento;
+
+Fragmento fragmentos[MAX_FRAGMENTOS]; // Fragmentos del catálogo
+int numFragmentos = 0; // Cantidad de fragmentos del catálogo
+pthread_t hiloSeguidor; // Hilo que aplica los diarios del principal (modo seguidor)
+atomic_llong pendienteDesde = 0; // Marca en ms del cambio más antiguo que el seguidor no había aplicado al empezar la pasada (0 si está al día)
+pthread_mutex_t candadoIngreso = PTHREAD_MUTEX_INITIALIZER; // Serializa los ingresos al catálogo
+atomic_ulong pasadasLector = 0; // Vueltas del hilo lector de solicitudes (cada una es un punto sin consultas en curso)
+atomic_int lectorActivo = 0;    // Indica si el hilo lector puede estar consultando una vista (0 mientras espera solicitudes)
+
+// Estructura para los ejemplares que un ingreso agrega a un libro ya existente
+typedef struct{
+	int pos;          // Posición del libro en el fragmento
+	int actuales;     // Ejemplares que tenía el libro antes del ingreso
+	int total;        // Ejemplares del libro después del ingreso
+	Ejemplar *lista;  // Lista nueva: los actuales se copian al publicar, los agregados ya están
+} Fusion;
 
-int buscarLibro(char*);
-void cambiarFecha(int, int);
-void reescribirArchivo(const char*, const char*);
+// Estructura para la copia de los libros de un fragmento que se escribe en un punto de control
+typedef struct{
+	Libro *libros;         // Copia de los libros (sus listas apuntan a la copia de los ejemplares)
+	Ejemplar *ejemplares;  // Copia de los ejemplares de todos los libros
+	int numLibros;         // Cantidad de libros copiados
+	int numEjemplares;     // Cantidad de ejemplares copiados
+} Instantanea;
+
+int abrirCatalogo(const char *fileDatos, int k);
+void cerrarCatalogo();
+int reparticionarCatalogo(const char *fileDatos, int k);
+Fragmento* fragmentoDe(const char *isbn);
+Libro* buscarLibro(Fragmento *frag, const char *isbn);
+int cambiarFecha(Requerimiento req);
 void generarReporte();
-char* obtenerFechaFutura();
+void obtenerFechaFutura(char *fecha, size_t tam);
 void escribirEstadoBD(const char *fileSalida);
-void gestionarPrestamo(Requerimiento req, int fd_SC);
+void responder(const Requerimiento *req, const char *msg);
+void gestionarPrestamo(Requerimiento req);
+void gestionarDevolucion(Requerimiento req);
+void responderConsulta(Requerimiento req);
+void consultarDisponibilidad(Requerimiento req);
+void gestionarReserva(Requerimiento req);
+void cancelarReservas(int cliente);
+int seguirFragmento(Fragmento *frag, Vista **vieja);
+long long retrasoReplicacion();
+int ingresarLibros(const char *ruta, char *resumen, size_t tam);
+void* ingresarEnSegundoPlano(void *arg);
+
+#ifdef CONTAR_MALLOC
+// Compilación de diagnóstico (make rp_contar): reemplaza malloc, calloc y realloc para
+// contar las reservas de memoria de cada hilo, incluidas las que hace la biblioteca de C.
+// Cada solicitud atendida debe terminar sin reservas nuevas; si no, el programa aborta.
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void *, size_t);
+__thread long reservasHilo = 0; // Reservas de memoria hechas por el hilo actual
+
+void *malloc(size_t tam) { reservasHilo++; return __libc_malloc(tam); }
+void *calloc(size_t n, size_t tam) { reservasHilo++; return __libc_calloc(n, tam); }
+void *realloc(void *p, size_t tam) { reservasHilo++; return __libc_realloc(p, tam); }
+
+#define RESERVAS_HILO reservasHilo
+#else
+#define RESERVAS_HILO 0L
+#endif
+
+// Función que verifica que una solicitud no haya reservado memoria (solo en rp_contar)
+void verificarReservas(long antes, Requerimiento *req) {
+	if (RESERVAS_HILO != antes) {
+		fprintf(stderr, "Error: la solicitud %c %s hizo %ld reservas de memoria\n", req->operacion, req->isbn, RESERVAS_HILO - antes);
+		abort();
+	}
+}
 
 int main(int argc, char *argv[]){
 
 	// Verifica que el número de argumentos sea suficiente
 	if(argc < 4){
-		printf("Uso correcto: $ ./ejecutable -p pipeReceptor –f filedatos [-v] [–s filesalida]\nDonde el contenido de los corchetes es opcional\n");
+		printf("Uso correcto: $ ./ejecutable -p pipeReceptor –f filedatos [-k fragmentos] [-F] [-v] [–s filesalida]\n"
+		       "              $ ./ejecutable -f filedatos -k fragmentos -R\nDonde el contenido de los corchetes es opcional\n");
 		return -1;
 	}
 
@@ -76,9 +258,11 @@ int main(int argc, char *argv[]){
 	char *fileDatos = NULL;
 	char *fileSalida = NULL;
 	int verbose = 0; // Bandera para habilitar/deshabilitar mensajes detallados
+	int k = 0; // Cantidad de fragmentos pedida (0 = la que ya tenga el catálogo)
+	int reparticionar = 0; // Bandera para reparticionar el catálogo y salir
 
 	// Procesa los parámetros de línea de comandos
-	while ((opt = getopt(argc, argv, "p:f:vs:")) != -1) {
+	while ((opt = getopt(argc, argv, "p:f:vs:k:RF")) != -1) {
 		switch (opt) {
 			case 'p':
 				pipeReceptor = optarg;  // Nombre del pipe receptor
@@ -92,27 +276,64 @@ int main(int argc, char *argv[]){
 			case 's':
 				fileSalida = optarg;  // Archivo de salida (opcional)
 				break;
+			case 'k':
+				k = atoi(optarg);  // Cantidad de fragmentos del catálogo
+				if(k < 1 || k > MAX_FRAGMENTOS){
+					fprintf(stderr, "Error: La cantidad de fragmentos debe estar entre 1 y %d.\n", MAX_FRAGMENTOS);
+					exit(1);
+				}
+				break;
+			case 'R':
+				reparticionar = 1;  // Reparticiona el catálogo sin iniciar el servidor
+				break;
+			case 'F':
+				seguidor = 1;  // Corre como seguidor de solo lectura del principal
+				break;
 			default:
-				fprintf(stderr, "Uso: %s -p pipeReceptor -f filedatos [-v] [-s filesalida]\n", argv[0]);
+				fprintf(stderr, "Uso: %s -p pipeReceptor -f filedatos [-k fragmentos] [-F] [-v] [-s filesalida]\n", argv[0]);
 				exit(1);
 		}
 	}
+	// Modo fuera de línea: reparticiona el catálogo en k fragmentos y termina
+	if (reparticionar) {
+		if (fileDatos == NULL || k == 0) {
+			fprintf(stderr, "Error: Los parametros -f y -k son obligatorios con -R.\n");
+			exit(1);
+		}
+		return reparticionarCatalogo(fileDatos, k) == 0 ? 0 : 1;
+	}
+
 	// Verifica que los parámetros obligatorios estén presentes
 	if (pipeReceptor == NULL || fileDatos == NULL) {
 		fprintf(stderr, "Error: Los parametros -p y -f son obligatorias.\n");
 		exit(1);
 	}
 
-	strcpy(database.file_name, fileDatos); // Copia el nombre del archivo de base de datos
+	snprintf(nombrePipe, sizeof(nombrePipe), "%s", pipeReceptor);
+
+	// Carga el catálogo en memoria e inicia los hilos de persistencia (o el de seguimiento)
+	if (abrirCatalogo(fileDatos, k) != 0) {
+		exit(1);
+	}
 
-	// Definición de los nombres de los pipes FIFO para la comunicación cliente-servidor
-	char fifo_SC[50], fifo_CS[50];
+	// SIGINT y SIGTERM detienen el servidor como el comando "s"; SIGPIPE se ignora para que
+	// un cliente que cierra su pipe de avisos no termine el servidor. Se instalan antes de
+	// crear el pipe: quien lo ve creado ya puede detener el servidor sin perder el catálogo
+	struct sigaction accion;
+	memset(&accion, 0, sizeof(accion));
+	accion.sa_handler = detenerServidor;
+	sigaction(SIGINT, &accion, NULL);
+	sigaction(SIGTERM, &accion, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	// Pipe Cliente-Servidor por el que llegan las solicitudes. Las respuestas van al pipe
+	// propio de cada cliente (/tmp/<pipe>_R<pid>), que crea el PS: así la respuesta que
+	// envía el hilo auxiliar al aplicar una solicitud llega al cliente que la hizo.
+	char fifo_CS[50];
 	snprintf(fifo_CS, sizeof(fifo_CS), "/tmp/%s_CS", pipeReceptor);  // Pipe Cliente-Servidor
-	snprintf(fifo_SC, sizeof(fifo_SC), "/tmp/%s_SC", pipeReceptor);  // Pipe Servidor-Cliente
 	
-	// Crea los pipes FIFO con permisos adecuados
+	// Crea el pipe FIFO con permisos adecuados
 	mkfifo(fifo_CS, S_IFIFO|0640);
-	mkfifo(fifo_SC, S_IFIFO|0640);
 
 	// Abre el pipe Cliente-Servidor en modo lectura
 	int fd_CS = open(fifo_CS, O_RDONLY | O_NONBLOCK);
@@ -120,103 +341,115 @@ int main(int argc, char *argv[]){
 		perror("Error abriendo fifo_CS");
 		exit(1);
 	}
-
-	// Abre el pipe Servidor-Cliente en modo lectura/escritura
-	int fd_SC = open(fifo_SC, O_RDWR | O_NONBLOCK);  // Abre para lectura/escritura
-	if (fd_SC == -1) {
-		perror("Error abriendo fifo_SC");
-		exit(1);
-	}
 	
+	tzset();  // Carga la zona horaria al inicio y no en la primera solicitud
+
 	// Muestra mensaje de bienvenida
 	printf("Bienvenido al sistema receptor de solicitudes de la Javeriana\n\n");
 
 	// Inicializa los semáforos
-	sem_init(&vacio, 0, N);  // Inicializa semáforo de espacios vacíos en el buffer
-	sem_init(&lleno, 0, 0);  // Inicializa semáforo de espacios llenos en el buffer
-	sem_init(&mutex, 0, 1);  // Inicializa semáforo de acceso exclusivo a la cola
+	sem_init(&lleno, 0, 0);  // Inicializa semáforo de solicitudes pendientes en el planificador
+	sem_init(&mutex, 0, 1);  // Inicializa semáforo de acceso exclusivo al planificador
 
 	pthread_t auxiliar1;  // Hilo para manejar solicitudes
 	pthread_t auxiliar2;  // Hilo para manejar comandos de consola
 	pthread_create(&auxiliar1, NULL, manejoRequerimientos, NULL);  // Crea un hilo para manejar las solicitudes
 	pthread_create(&auxiliar2, NULL, manejoComandos, NULL);  // Crea un hilo para manejar los comandos
+	pthread_detach(auxiliar2);  // Puede quedar bloqueado leyendo la consola si se termina con una señal
 
 	int read_bytes;
 	Requerimiento req;  // Solicitud de operación
 	
 	// Bucle principal que procesa las solicitudes de los clientes
+	atomic_store(&lectorActivo, 1);
 	while(continuar){
+		// Entre solicitudes el hilo no tiene vistas en uso: las vistas reemplazadas antes se pueden liberar
+		atomic_fetch_add(&pasadasLector, 1);
 		read_bytes = read(fd_CS, &req, sizeof(Requerimiento));
-		if (read_bytes == -1) {
-			if (errno == EAGAIN || errno == EWOULDBLOCK) {
-				// No hay datos disponibles, continuar sin bloquear
-				usleep(100000);
+		if (read_bytes == 0) {
+			// Ningún cliente tiene el pipe abierto: no hay solicitud nueva. Mientras espera no
+			// consulta vistas, así que quien retira una no tiene que esperar a que despierte
+			atomic_store(&lectorActivo, 0);
+			usleep(100000);
+			atomic_exchange(&lectorActivo, 1);
+			continue;
+		} else if (read_bytes != -1 && read_bytes != sizeof(Requerimiento)) {
+			fprintf(stderr, "Solicitud incompleta descartada (%d bytes)\n", read_bytes);
+			continue;
+		} else if (read_bytes == -1) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+				// No hay datos disponibles: espera hasta que lleguen (máximo 100 ms para revisar continuar)
+				struct pollfd espera = {fd_CS, POLLIN, 0};
+				atomic_store(&lectorActivo, 0);
+				poll(&espera, 1, 100);
+				atomic_exchange(&lectorActivo, 1);
 				continue;
 			} else {
 				perror("Error al leer del FIFO");
 				close(fd_CS);
-				close(fd_SC);
 				exit(1);
 			}
 		}
 
+		long reservasAntes = RESERVAS_HILO;  // Para verificar que la solicitud no reserve memoria
+
 		// Si la opción verbose está habilitada, imprime la solicitud recibida
-		if (verbose && read_bytes == sizeof(Requerimiento)) {
+		if (verbose) {
 			printf("\nRecibido: %c, %s, %s\n", req.operacion, req.nombre, req.isbn);
 		}
 
-		// Maneja las operaciones de devolver ('D') o renovar ('R')
-		if(req.operacion == 'D' || req.operacion == 'R'){
-		
-			char *msg = (char *)malloc(256 * sizeof(char));  // Crea un mensaje de respuesta
-			if(req.operacion == 'D'){
-				sprintf(msg, "La biblioteca esta recibiendo el libro %s\n", req.nombre);
-			}else{
-				char* nueva_fecha_str = obtenerFechaFutura();  // Obtiene la nueva fecha de entrega
-				sprintf(msg, "La biblioteca ha renovado la fecha de entrega del libro %s, entreguelo antes del %s\n", req.nombre, nueva_fecha_str);
+		// La consulta de disponibilidad se responde aquí mismo desde la vista, sin candados ni cola
+		if(req.operacion == 'C'){
+			consultarDisponibilidad(req);
+		// El seguidor no acepta ingresos al catálogo
+		}else if(seguidor && req.operacion == 'A'){
+			responder(&req, "Replica de solo lectura: los ingresos se hacen en el servidor principal\n");
+		// El seguidor no modifica el catálogo: responde con la disponibilidad del libro
+		}else if(seguidor && (req.operacion == 'D' || req.operacion == 'R' || req.operacion == 'P' || req.operacion == 'E')){
+			responderConsulta(req);
+		// Las operaciones que modifican el catálogo pasan por la cola del cliente en el
+		// planificador; el hilo auxiliar responde cuando la aplica. Si la cola del cliente
+		// está llena la solicitud se rechaza: este hilo nunca espera por un cliente.
+		}else if(req.operacion == 'D' || req.operacion == 'R' || req.operacion == 'P' || req.operacion == 'E'){
+			if(!encolarRequerimiento(req)){
+				char msg[256];
+				snprintf(msg, sizeof(msg), "El servidor esta ocupado, intente de nuevo la solicitud del libro %s\n", req.nombre);
+				responder(&req, msg);
 			}
-
-			// Envía la respuesta al cliente
-			ssize_t bytes_written = write(fd_SC, msg, strlen(msg));
-			if(bytes_written == -1){
-				perror("Error escribiendo en el FIFO");
-				close(fd_SC);
-				close(fd_CS);
-				free(msg);
-				exit(1);
+		}else if(req.operacion == 'A'){ // Ingresa al catálogo los libros del archivo indicado en el nombre
+			char msg[256];
+			pthread_t hiloIngreso;
+			char *ruta = strdup(req.nombre);
+			if(ruta != NULL && pthread_create(&hiloIngreso, NULL, ingresarEnSegundoPlano, ruta) == 0){
+				pthread_detach(hiloIngreso);
+				snprintf(msg, sizeof(msg), "Ingreso de %s iniciado, el resultado se mostrara en la consola del servidor\n", req.nombre);
+			}else{
+				free(ruta);
+				snprintf(msg, sizeof(msg), "No se pudo iniciar el ingreso de %s\n", req.nombre);
 			}
-			free(msg);
-
-			// Sincroniza el acceso a la cola de solicitudes con semáforos
-			sem_wait(&vacio);
-			sem_wait(&mutex);
-
-			// Inserta la solicitud en el buffer circular
-			buffer[in] = req;
-			in = (in+1)%N;
-
-			sem_post(&mutex);
-			sem_post(&lleno);
-
-		// Maneja las solicitudes de préstamo (operación 'P')
-		}else if(req.operacion == 'P'){
-			gestionarPrestamo(req, fd_SC);
+			responder(&req, msg);
+			reservasAntes = RESERVAS_HILO;  // El ingreso es administrativo: sus reservas no cuentan
 		}else if(req.operacion == 'Q'){ // Maneja el caso de salida (operación 'Q')
-			printf("\nEl usuario del PS notifica que no se enviaran mas solicitudes.\n\n");
-			break;
+			// Solo termina la sesión de ese PS: el servidor sigue atendiendo a los demás
+			// clientes hasta la orden de terminar ("s" o SIGINT/SIGTERM)
+			printf("\nEl usuario del PS %d notifica que no se enviaran mas solicitudes.\n\n", req.cliente);
+			cancelarReservas(req.cliente);  // Sus reservas ya no se pueden avisar
+			terminarSesion(req.cliente);    // Su sesión en el planificador queda libre
+			responder(&req, "Sesion terminada\n");
 		}
-		sleep(1);  // Pausa para evitar sobrecargar la CPU
+		verificarReservas(reservasAntes, &req);
 	}
+	atomic_store(&lectorActivo, 0);  // Ya no se consultan vistas
 
-	// Cierra los pipes y espera que el hilo termine
-	close(fd_SC);
+	// Cierra el pipe y espera que el hilo termine
 	close(fd_CS);
 
+	// Ya no se encolan solicitudes: el hilo aplica y responde las pendientes (ya recibidas)
+	// y termina al encontrar la cola vacía
+	sem_post(&lleno);
 	pthread_join(auxiliar1, NULL);  // Espera al hilo que maneja los requerimientos
-	pthread_join(auxiliar2, NULL);  // Espera al hilo que maneja los comandos de consola
 
 	// Destruye los semáforos
-	sem_destroy(&vacio);
 	sem_destroy(&lleno);
 	sem_destroy(&mutex);
 
@@ -224,6 +457,9 @@ int main(int argc, char *argv[]){
 	if(fileSalida != NULL){
 		escribirEstadoBD(fileSalida);
 	}
+
+	// Guarda los cambios pendientes y detiene los hilos de persistencia
+	cerrarCatalogo();
 	return 0;
 }
 
@@ -234,6 +470,9 @@ void* manejoComandos(void* arg){
 	while(continuar){
 		// Lee el comando del usuario
 		if(fgets(buffer, sizeof(buffer), stdin) == NULL){
+			if(feof(stdin)){
+				break;  // Sin consola el servidor se detiene con SIGINT o SIGTERM
+			}
 			perror("Error al leer mensaje");
 			continue;
 		}
@@ -244,12 +483,23 @@ void* manejoComandos(void* arg){
 
 		// Si el comando es "s", termina el programa
 		if(strcmp(buffer, "s") == 0){
-			continuar = 0;  // Finaliza el bucle
-			sem_post(&lleno);  // Actualiza el otro hilo para terminar su ejecucion
+			continuar = 0;  // Finaliza el bucle (el hilo principal despierta al de solicitudes)
 			break;
 		} else if(strcmp(buffer, "r") == 0){	// Si el comando es "r", genera un reporte
 			generarReporte();
 			continue;
+		} else if(strcmp(buffer, "m") == 0){	// Si el comando es "m", muestra la espera en cola por cliente
+			mostrarMetricas();
+			continue;
+		} else if(strncmp(buffer, "a ", 2) == 0){	// Si el comando es "a archivo", ingresa libros nuevos
+			char resumen[256];
+			if(seguidor){
+				printf("Replica de solo lectura: los ingresos se hacen en el servidor principal\n");
+			}else{
+				ingresarLibros(buffer + 2, resumen, sizeof(resumen));
+				printf("%s", resumen);
+			}
+			continue;
 		}
 	}
 	return NULL;
@@ -257,292 +507,1955 @@ void* manejoComandos(void* arg){
 
 // Función que maneja las solicitudes de libros
 void* manejoRequerimientos(void* arg){
-	while(continuar){
-		// Espera a que haya una solicitud en el buffer
+	while(1){
+		// Espera a que haya una solicitud en el planificador
 		sem_wait(&lleno);
-		sem_wait(&mutex);
 
-		// Extrae la solicitud del buffer circular
-		Requerimiento req = buffer[out];
-		out = (out+1) % N;
+		// Extrae la solicitud de la sesión a la que le toca el turno; sin solicitudes
+		// pendientes solo se despierta cuando el servidor termina
+		Requerimiento req;
+		if(!extraerRequerimiento(&req)){
+			if(!continuar){
+				break;
+			}
+			continue;
+		}
+
+		// Aplica la solicitud y responde al cliente
+		long reservasAntes = RESERVAS_HILO;
+		if(req.operacion == 'P'){
+			gestionarPrestamo(req);
+		}else if(req.operacion == 'E'){
+			gestionarReserva(req);
+		}else{
+			gestionarDevolucion(req);  // Devolver ('D') o renovar ('R')
+		}
+		verificarReservas(reservasAntes, &req);
+	}
+	return NULL;
+}
+
+// Manejador de SIGINT y SIGTERM: solo cambia la variable atómica (seguro en una señal)
+void detenerServidor(int senal) {
+	continuar = 0;
+}
+
+// Función que obtiene la hora actual en microsegundos
+long long microsegundosActuales() {
+	struct timeval ahora;
+	gettimeofday(&ahora, NULL);
+	return (long long)ahora.tv_sec * 1000000 + ahora.tv_usec;
+}
+
+// Función que busca la sesión de un cliente o le asigna una (con el mutex tomado). Una sesión
+// solo pasa a otro cliente cuando el suyo envió 'Q' o lleva SESION_INACTIVA segundos sin
+// solicitudes, así las métricas de un cliente activo no se pierden. Devuelve NULL si no hay.
+Sesion* buscarSesion(int cliente, long long ahora) {
+	Sesion *libre = NULL;
+	for (int i = 0; i < MAX_SESIONES; i++) {
+		Sesion *ses = &sesiones[i];
+		if (ses->cliente == cliente) {
+			return ses;
+		}
+		if (ses->cliente == 0) {
+			if (libre == NULL || libre->cliente != 0) {
+				libre = ses;  // Prefiere una sesión libre a una inactiva
+			}
+		} else if (ses->cantidad == 0 && ahora - ses->ultimaActividad > SESION_INACTIVA * 1000000LL &&
+		           (libre == NULL || (libre->cliente != 0 && ses->ultimaActividad < libre->ultimaActividad))) {
+			libre = ses;  // Entre las inactivas, la que lleva más tiempo sin solicitudes
+		}
+	}
+	if (libre != NULL) {
+		libre->cliente = cliente;
+		libre->in = libre->out = libre->deficit = 0;
+		memset(&libre->metricas, 0, sizeof(Metricas));
+	}
+	return libre;
+}
+
+// Función que inserta una solicitud en la cola de su cliente sin esperar. Devuelve 0 si la
+// cola del cliente está llena o no hay una sesión para él (la solicitud se rechaza).
+int encolarRequerimiento(Requerimiento req) {
+	long long ahora = microsegundosActuales();
 
+	sem_wait(&mutex);
+	Sesion *ses = buscarSesion(req.cliente, ahora);
+	if (ses == NULL || ses->cantidad == N) {
 		sem_post(&mutex);
-		sem_post(&vacio);
-
-		// Si el sistema sigue activo, procesa la solicitud
-		if(continuar != 0){
-			// Abre el archivo de la base de datos en modo lectura y escritura
-			database.archivo = fopen(database.file_name,"r+");
-			if(database.archivo == NULL){
-				perror("No se pudo abrir el archivo");
-				break;
+		return 0;
+	}
+	ses->clase = req.clase == 'L' ? 'L' : 'I';
+	ses->ultimaActividad = ahora;
+
+	// Inserta la solicitud en el buffer circular de la sesión
+	ses->buffer[ses->in] = req;
+	ses->llegada[ses->in] = ahora;
+	ses->in = (ses->in+1)%N;
+	ses->cantidad++;
+
+	sem_post(&mutex);
+	sem_post(&lleno);
+	return 1;
+}
+
+// Función que libera la sesión de un cliente que terminó (operación 'Q'). Si todavía tiene
+// solicitudes pendientes se conserva y se libera cuando pase SESION_INACTIVA sin solicitudes.
+void terminarSesion(int cliente) {
+	sem_wait(&mutex);
+	for (int i = 0; i < MAX_SESIONES; i++) {
+		if (sesiones[i].cliente == cliente && sesiones[i].cantidad == 0) {
+			sesiones[i].cliente = 0;
+		}
+	}
+	sem_post(&mutex);
+}
+
+// Función que registra en las métricas la espera de una solicitud
+void registrarEspera(Metricas *m, long long espera) {
+	int cubeta = 0;
+	while (cubeta < CUBETAS - 1 && espera >= (1LL << cubeta)) {
+		cubeta++;
+	}
+	m->atendidas++;
+	m->esperaTotal += espera;
+	if (espera > m->esperaMax) {
+		m->esperaMax = espera;
+	}
+	m->histograma[cubeta]++;
+}
+
+// Función que extrae la próxima solicitud: primero la clase interactiva y, dentro de
+// cada clase, round-robin por déficit entre las sesiones (QUANTUM solicitudes por turno)
+int extraerRequerimiento(Requerimiento *req) {
+	const char clases[2] = {'I', 'L'};
+	int hay = 0;
+
+	sem_wait(&mutex);
+	for (int c = 0; c < 2 && !hay; c++) {
+		for (int k = 0; k < MAX_SESIONES; k++) {
+			int i = (turno[c] + k) % MAX_SESIONES;
+			Sesion *ses = &sesiones[i];
+			if (ses->cantidad == 0 || ses->clase != clases[c]) {
+				continue;
 			}
-			// Busca el libro por su ISBN
-			int cantidad = buscarLibro(req.isbn);
-			strcpy(database.isbnLibro, req.isbn);
-			
-			// Cambia la fecha dependiendo de la operación
-			if(req.operacion == 'D'){
-				cambiarFecha(cantidad, 0);  // Devolver libro
-			}else{
-				cambiarFecha(cantidad, 1);  // Renovar libro
+
+			// Al comenzar su turno la sesión recibe el quantum
+			if (ses->deficit == 0) {
+				ses->deficit = QUANTUM;
 			}
-			fclose(database.archivo);  // Cierra el archivo de la base de datos
+			*req = ses->buffer[ses->out];
+			long long espera = microsegundosActuales() - ses->llegada[ses->out];
+			ses->out = (ses->out+1) % N;
+			ses->cantidad--;
+			ses->deficit--;
+
+			// Una sesión sin solicitudes pierde el déficit que le quedaba
+			if (ses->cantidad == 0) {
+				ses->deficit = 0;
+			}
+			// Si agotó su turno, el siguiente es para la próxima sesión de la clase
+			turno[c] = ses->deficit == 0 ? (i + 1) % MAX_SESIONES : i;
+
+			registrarEspera(&ses->metricas, espera);
+			registrarEspera(&metricasClase[c], espera);
+			hay = 1;
+			break;
 		}
-		sleep(1);  // Pausa antes de procesar otra solicitud
 	}
-	return NULL;
+	sem_post(&mutex);
+	return hay;
 }
 
-// Función que genera un reporte de los ejemplares
-void generarReporte() {
-	// Abre el archivo de base de datos en modo lectura
-	FILE *archivo = fopen(database.file_name, "r");
-	if (archivo == NULL) {
-		perror("No se pudo abrir el archivo de base de datos");
-		return;
+// Función que calcula el percentil p (0-100) de espera a partir del histograma
+long long percentilEspera(Metricas *m, double p) {
+	long long acumulado = 0;
+	for (int b = 0; b < CUBETAS; b++) {
+		acumulado += m->histograma[b];
+		if (acumulado * 100.0 >= p * m->atendidas) {
+			return 1LL << b;  // Cota superior de la cubeta
+		}
 	}
+	return 1LL << (CUBETAS - 1);
+}
 
-	char linea[256];
-	char nombre[30], isbn[30], estado;
-	int ejemplar;
-	char fecha[12];
+// Función que muestra las métricas de espera en cola por clase y por cliente
+void mostrarMetricas() {
+	const char *nombres[2] = {"Interactivos", "Lote"};
+
+	sem_wait(&mutex);
+	printf("\nEspera en cola del planificador (microsegundos):\n");
+	printf("Clase, Atendidas, Promedio, p99 (<), Maximo\n");
+	for (int c = 0; c < 2; c++) {
+		Metricas *m = &metricasClase[c];
+		printf("%s, %lld, %lld, %lld, %lld\n", nombres[c], m->atendidas,
+		       m->atendidas > 0 ? m->esperaTotal / m->atendidas : 0, m->atendidas > 0 ? percentilEspera(m, 99) : 0, m->esperaMax);
+	}
+	printf("Cliente, Clase, Pendientes, Atendidas, Promedio, p99 (<), Maximo\n");
+	for (int i = 0; i < MAX_SESIONES; i++) {
+		Sesion *ses = &sesiones[i];
+		Metricas *m = &ses->metricas;
+		if (ses->cliente == 0) {
+			continue;
+		}
+		printf("%d, %c, %d, %lld, %lld, %lld, %lld\n", ses->cliente, ses->clase, ses->cantidad, m->atendidas,
+		       m->atendidas > 0 ? m->esperaTotal / m->atendidas : 0, m->atendidas > 0 ? percentilEspera(m, 99) : 0, m->esperaMax);
+	}
+	sem_post(&mutex);
+}
 
+// Función que genera un reporte de los ejemplares
+void generarReporte() {
 	printf("\nReporte de ejemplares:\n");
+	if (seguidor) {
+		printf("(Replica de solo lectura, retraso de replicacion: %lld ms)\n", retrasoReplicacion());
+	}
 	printf("Status, Nombre del Libro, ISBN, Ejemplar, Fecha\n");
 
-	while (fgets(linea, sizeof(linea), archivo)) {
-		if (sscanf(linea, "%d, %c, %s\n", &ejemplar, &estado, fecha) == 3) {
-			printf("%c, %s, %s, %d, %s\n", estado, database.nombreLibro, isbn, ejemplar, fecha);
-		} else if (sscanf(linea, "%29[^,], %29[^,], %d\n", nombre, isbn, &ejemplar) == 3) {
-			// Actualiza el nombre e ISBN del libro actual
-			strcpy(database.nombreLibro, nombre);
-			strcpy(database.isbnLibro, isbn);
+	for (int f = 0; f < numFragmentos; f++) {
+		Fragmento *frag = &fragmentos[f];
+		pthread_mutex_lock(&frag->candado);
+		for (int i = 0; i < frag->numLibros; i++) {
+			Libro *libro = &frag->libros[i];
+			for (int j = 0; j < libro->ejemplares; j++) {
+				Ejemplar *ej = &libro->lista[j];
+				printf("%c, %s, %s, %d, %s\n", ej->estado, libro->nombre, libro->isbn, ej->numero, ej->fecha);
+			}
 		}
+		pthread_mutex_unlock(&frag->candado);
 	}
-
-	fclose(archivo);
 }
 
 // Función que escribe el estado de la base de datos en un archivo
 void escribirEstadoBD(const char *fileSalida) {
-	// Abre el archivo de base de datos en modo lectura
-	FILE *archivo = fopen(database.file_name, "r");
-	if (archivo == NULL) {
-		perror("No se pudo abrir el archivo de base de datos");
-		return;
-	}
-
 	// Abre el archivo de salida en modo escritura
 	FILE *salida = fopen(fileSalida, "w");
 	if (salida == NULL) {
 		perror("No se pudo abrir el archivo de salida");
-		fclose(archivo);
 		return;
 	}
 
-	char linea[256];
-	char nombre[30], isbn[30], estado;
-	int ejemplar, ejemplares = 0, total_disponibles = 0;
-	char fecha[12];
-	char libro_actual[30] = "";
-
 	fprintf(salida, "Nombre del Libro, ISBN, Ejemplar, Estado, Fecha\n\n");
 
-	while (fgets(linea, sizeof(linea), archivo)) {
-		if (sscanf(linea, "%d, %c, %s\n", &ejemplar, &estado, fecha) == 3) {
-			if (strcmp(libro_actual, database.nombreLibro) != 0) {
-				if (strlen(libro_actual) > 0) {
-					fprintf(salida, "Total disponibles: %d\n\n", total_disponibles);
-				}
-				strcpy(libro_actual, database.nombreLibro);
-				total_disponibles = 0; // Reinicia el contador de disponibles
-			}
-			if (estado == 'D') {
-				total_disponibles++;
-			}
-			// Escribe la información del ejemplar en el archivo de salida
-			fprintf(salida, "%s, %s, %d, %c, %s\n", database.nombreLibro, database.isbnLibro, ejemplar, estado, fecha);
-		} else if (sscanf(linea, "%29[^,], %29[^,], %d\n", nombre, isbn, &ejemplares) == 3) {
-			if (strcmp(libro_actual, nombre) != 0) {
-				if (strlen(libro_actual) > 0) {
-					fprintf(salida, "Total disponibles: %d\n\n", total_disponibles);
+	for (int f = 0; f < numFragmentos; f++) {
+		Fragmento *frag = &fragmentos[f];
+		pthread_mutex_lock(&frag->candado);
+		for (int i = 0; i < frag->numLibros; i++) {
+			Libro *libro = &frag->libros[i];
+			int total_disponibles = 0;
+			fprintf(salida, "%s, %s, %d: \n", libro->nombre, libro->isbn, libro->ejemplares);
+			for (int j = 0; j < libro->ejemplares; j++) {
+				Ejemplar *ej = &libro->lista[j];
+				if (ej->estado == 'D') {
+					total_disponibles++;
 				}
-				strcpy(libro_actual, nombre);
-				total_disponibles = 0; // Reinicia el contador de disponibles
+				// Escribe la información del ejemplar en el archivo de salida
+				fprintf(salida, "%s, %s, %d, %c, %s\n", libro->nombre, libro->isbn, ej->numero, ej->estado, ej->fecha);
 			}
-			strcpy(database.nombreLibro, nombre);
-			strcpy(database.isbnLibro, isbn);
-			fprintf(salida, "%s, %s, %d: \n", nombre, isbn, ejemplares);
+			fprintf(salida, "Total disponibles: %d\n\n", total_disponibles);
 		}
+		pthread_mutex_unlock(&frag->candado);
 	}
 
-	if (strlen(libro_actual) > 0) {
-		fprintf(salida, "Total disponibles: %d\n\n", total_disponibles);
+	fclose(salida);
+}
+
+// Función que calcula el fragmento al que pertenece un ISBN (hash djb2)
+Fragmento* fragmentoDe(const char *isbn) {
+	unsigned int hash = 5381;
+	for (const char *c = isbn; *c != '\0'; c++) {
+		hash = hash * 33 + (unsigned char)*c;
 	}
+	return &fragmentos[hash % numFragmentos];
+}
 
-	fclose(archivo);
-	fclose(salida);
+// Función hash FNV-1a del ISBN, usada por el índice de cada fragmento
+unsigned int hashIndice(const char *isbn) {
+	unsigned int hash = 2166136261u;
+	for (const char *c = isbn; *c != '\0'; c++) {
+		hash = (hash ^ (unsigned char)*c) * 16777619u;
+	}
+	return hash;
 }
 
-// Función que busca un libro por su ISBN en el archivo
-int buscarLibro(char *isbnDado){
-	char nombre[30], isbn[30], linea[256];
-	int encontrado=0, ejemplares = 0;
+// Función que agrega la posición pos de libros a un índice de tamaño tam
+void indexarLibro(int *indice, int tam, Libro *libros, int pos) {
+	unsigned int h = hashIndice(libros[pos].isbn) & (tam - 1);
+	while (indice[h] != 0) {
+		h = (h + 1) & (tam - 1);
+	}
+	indice[h] = pos + 1;
+}
 
-	// Lee las líneas del archivo hasta encontrar el libro
-	while(fscanf(database.archivo, "%29[^,], %29[^,], %d\n", nombre, isbn, &ejemplares) == 3){
-		if(strcmp(isbnDado, isbn) == 0){
-			encontrado = 1;
-			break;
-		}else{
-			while(ejemplares>0 && fgets(linea, sizeof(linea), database.archivo)){
-				ejemplares--;
-			}
+// Función que construye el índice de n libros con espacio para capacidad libros
+int* construirIndice(Libro *libros, int n, int capacidad, int *tam) {
+	*tam = 16;
+	while (*tam < 2 * capacidad) {
+		*tam *= 2;
+	}
+	int *indice = (int *)calloc(*tam, sizeof(int));
+	if (indice == NULL) {
+		perror("No se pudo reservar memoria para el indice");
+		exit(1);
+	}
+	for (int i = 0; i < n; i++) {
+		indexarLibro(indice, *tam, libros, i);
+	}
+	return indice;
+}
+
+// Función que busca en un índice la posición de un ISBN (-1 si no está)
+int buscarEnIndice(int *indice, int tam, Libro *libros, const char *isbn) {
+	unsigned int h = hashIndice(isbn) & (tam - 1);
+	while (indice[h] != 0) {
+		if (strcmp(libros[indice[h] - 1].isbn, isbn) == 0) {
+			return indice[h] - 1;
+		}
+		h = (h + 1) & (tam - 1);
+	}
+	return -1;
+}
+
+// Función que busca la posición de un libro en el fragmento sin mensajes (-1 si no está)
+int posicionLibro(Fragmento *frag, const char *isbn) {
+	if (frag->indice != NULL) {
+		return buscarEnIndice(frag->indice, frag->tamIndice, frag->libros, isbn);
+	}
+	for (int i = 0; i < frag->numLibros; i++) {
+		if (strcmp(frag->libros[i].isbn, isbn) == 0) {
+			return i;
 		}
 	}
-	if(!encontrado){
+	return -1;
+}
+
+// Función que busca un libro por su ISBN dentro de un fragmento (con el candado tomado)
+Libro* buscarLibro(Fragmento *frag, const char *isbn) {
+	int pos = posicionLibro(frag, isbn);
+	if (pos == -1) {
 		printf("Libro no encontrado\n");
+		return NULL;
 	}
-	return ejemplares;
+	return &frag->libros[pos];
 }
 
-// Función que obtiene la fecha futura (7 días a partir de hoy)
-char* obtenerFechaFutura() {
-	time_t ahora = time(NULL);
-	ahora += 7 * 24 * 60 * 60; // Suma 7 días
-	struct tm *hoy = localtime(&ahora);
-	static char nueva_fecha_str[12];
-	strftime(nueva_fecha_str, sizeof(nueva_fecha_str), "%d-%m-%Y", hoy);
-	return nueva_fecha_str;
+// Función que convierte una fecha dd-mm-aaaa en un entero aaaammdd que se puede comparar (0 si no es válida)
+int fechaComparable(const char *fecha) {
+	char *fin;
+	long dia = strtol(fecha, &fin, 10);
+	if (*fin != '-') {
+		return 0;
+	}
+	long mes = strtol(fin + 1, &fin, 10);
+	if (*fin != '-') {
+		return 0;
+	}
+	long anio = strtol(fin + 1, &fin, 10);
+	return (int)(anio * 10000 + mes * 100 + dia);
 }
 
-// Función que cambia la fecha de devolución de un libro
-void cambiarFecha(int cantidad, int bandera) {
-	char estadoActual, fecha[12], nueva_fecha_str[12];
-	int ejemplar, encontrado = 0;
-	char linea[256];
-	char nueva_linea[256] = "";
-
-	// Modifica la fecha dependiendo de si es una renovación o devolución
-	while(cantidad > 0 && fgets(linea, sizeof(linea), database.archivo) && !encontrado) {
-		if(sscanf(linea, "%d, %c, %s\n", &ejemplar, &estadoActual, fecha) == 3) {
-			if(estadoActual == 'P') {
-				encontrado = 1;
-				time_t ahora = time(NULL);
-
-				if(bandera) {	// Si es renovación, suma 7 días a la fecha actual
-					ahora += 7 * 24 * 60 * 60;
-				}else {		// Si es devolución, establece la fecha actual
-					estadoActual = 'D';
-				}
-				
-				struct tm *hoy = localtime(&ahora);
-				strftime(nueva_fecha_str, sizeof(nueva_fecha_str), "%d-%m-%Y", hoy);
-				snprintf(nueva_linea, sizeof(nueva_linea), "%d, %c, %s\n", ejemplar, estadoActual, nueva_fecha_str);
-				break;
+// Función que calcula los ejemplares disponibles de un libro y su fecha de entrega más próxima
+void resumirLibro(const Libro *libro, int *disponibles, int *proxima) {
+	*disponibles = 0;
+	*proxima = 0;
+	for (int i = 0; i < libro->ejemplares; i++) {
+		if (libro->lista[i].estado == 'D') {
+			(*disponibles)++;
+		} else if (libro->lista[i].estado == 'P') {
+			int fecha = fechaComparable(libro->lista[i].fecha);
+			if (fecha != 0 && (*proxima == 0 || fecha < *proxima)) {
+				*proxima = fecha;
 			}
 		}
-		cantidad--;
 	}
+}
+
+// Función que llena la disponibilidad de un libro en una vista que todavía no se publica
+void llenarDisponibilidad(Disponibilidad *disp, const Libro *libro) {
+	int disponibles, proxima;
+	resumirLibro(libro, &disponibles, &proxima);
+	atomic_store_explicit(&disp->disponibles, disponibles, memory_order_relaxed);
+	atomic_store_explicit(&disp->total, libro->ejemplares, memory_order_relaxed);
+	atomic_store_explicit(&disp->proximaEntrega, proxima, memory_order_relaxed);
+}
 
-	// Si se encontró el libro, reescribe la línea con la nueva fecha
-	if(encontrado) {
-		reescribirArchivo(linea, nueva_linea);
+// Función que arma la vista de consultas de n libros (índice e ISBN; la disponibilidad la llena quien la usa)
+Vista* construirVista(const Libro *libros, int n) {
+	Vista *vista = (Vista *)malloc(sizeof(Vista));
+	Disponibilidad *disp = (Disponibilidad *)calloc(n + 1, sizeof(Disponibilidad));
+	if (vista == NULL || disp == NULL) {
+		perror("No se pudo reservar memoria para la vista de consultas");
+		exit(1);
 	}
+	vista->libros = disp;
+	vista->numLibros = n;
+	vista->tamIndice = 16;
+	while (vista->tamIndice < 2 * n) {
+		vista->tamIndice *= 2;
+	}
+	vista->indice = (int *)calloc(vista->tamIndice, sizeof(int));
+	if (vista->indice == NULL) {
+		perror("No se pudo reservar memoria para la vista de consultas");
+		exit(1);
+	}
+	for (int i = 0; i < n; i++) {
+		strcpy(disp[i].isbn, libros[i].isbn);
+		unsigned int h = hashIndice(libros[i].isbn) & (vista->tamIndice - 1);
+		while (vista->indice[h] != 0) {
+			h = (h + 1) & (vista->tamIndice - 1);
+		}
+		vista->indice[h] = i + 1;
+	}
+	return vista;
 }
 
-// Función para reescribir el archivo de base de datos con la nueva información
-void reescribirArchivo(const char *linea_original, const char *linea_nueva) {
-	FILE *temp = fopen("temp.txt", "w");  // Archivo temporal para escritura
-	if (!temp) {
-		perror("No se pudo abrir archivo temporal");
+// Función que busca la posición de un ISBN en una vista de consultas (-1 si no está)
+int buscarEnVista(const Vista *vista, const char *isbn) {
+	unsigned int h = hashIndice(isbn) & (vista->tamIndice - 1);
+	while (vista->indice[h] != 0) {
+		if (strcmp(vista->libros[vista->indice[h] - 1].isbn, isbn) == 0) {
+			return vista->indice[h] - 1;
+		}
+		h = (h + 1) & (vista->tamIndice - 1);
+	}
+	return -1;
+}
+
+// Función que libera una vista de consultas
+void liberarVista(Vista *vista) {
+	if (vista != NULL) {
+		free(vista->libros);
+		free(vista->indice);
+		free(vista);
+	}
+}
+
+// Función que espera a que el hilo lector deje de usar las vistas publicadas antes de la llamada.
+// El lector solo usa una vista durante una solicitud, así que basta con verlo empezar otra vuelta
+// o esperando solicitudes (en ese caso la próxima que atienda ya lee las vistas nuevas).
+void esperarLector() {
+	atomic_thread_fence(memory_order_seq_cst);  // Las vistas nuevas se publican antes de mirar al lector
+	unsigned long inicio = atomic_load(&pasadasLector);
+	while (atomic_load(&lectorActivo) && atomic_load(&pasadasLector) == inicio) {
+		usleep(100);
+	}
+}
+
+// Función que libera las vistas reemplazadas cuando el hilo lector ya no puede estar usándolas.
+// Se espera una sola vez por todas, no una vez por vista.
+void retirarVistas(Vista **vistas, int n) {
+	int pendientes = 0;
+	for (int i = 0; i < n; i++) {
+		pendientes |= vistas[i] != NULL;
+	}
+	if (pendientes) {
+		esperarLector();
+	}
+	for (int i = 0; i < n; i++) {
+		liberarVista(vistas[i]);
+	}
+}
+
+// Función que publica una vista nueva con todos los libros del fragmento (con el candado tomado).
+// Devuelve la vista anterior, que se retira después de soltar el candado.
+Vista* publicarVista(Fragmento *frag) {
+	Vista *vista = construirVista(frag->libros, frag->numLibros);
+	for (int i = 0; i < frag->numLibros; i++) {
+		llenarDisponibilidad(&vista->libros[i], &frag->libros[i]);
+	}
+	return atomic_exchange(&frag->vista, vista);
+}
+
+// Función que actualiza en la vista la disponibilidad de un libro que cambió (con el candado tomado).
+// Escritura del seqlock: el contador queda impar mientras cambian los campos del libro.
+void actualizarVista(Fragmento *frag, int pos) {
+	Vista *vista = atomic_load_explicit(&frag->vista, memory_order_relaxed);  // Solo cambia con el candado tomado
+	if (vista == NULL || pos >= vista->numLibros) {
 		return;
 	}
+	int disponibles, proxima;
+	resumirLibro(&frag->libros[pos], &disponibles, &proxima);
+	Disponibilidad *disp = &vista->libros[pos];
+	unsigned int secuencia = atomic_load_explicit(&frag->secuencia, memory_order_relaxed);
+	atomic_store_explicit(&frag->secuencia, secuencia + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	atomic_store_explicit(&disp->disponibles, disponibles, memory_order_relaxed);
+	atomic_store_explicit(&disp->total, frag->libros[pos].ejemplares, memory_order_relaxed);
+	atomic_store_explicit(&disp->proximaEntrega, proxima, memory_order_relaxed);
+	atomic_store_explicit(&frag->secuencia, secuencia + 2, memory_order_release);
+}
+
+// Función que escribe en fecha la fecha de entrega (7 días a partir de hoy)
+void obtenerFechaFutura(char *fecha, size_t tam) {
+	time_t ahora = time(NULL);
+	ahora += 7 * 24 * 60 * 60; // Suma 7 días
+	struct tm hoy;
+	localtime_r(&ahora, &hoy);  // Versión reentrante: no comparte un búfer estático entre hilos
+	strftime(fecha, tam, "%d-%m-%Y", &hoy);
+}
 
-	rewind(database.archivo);  // Vuelve al principio del archivo original
+// Función que obtiene la hora actual en milisegundos
+long long milisegundosActuales() {
+	struct timeval ahora;
+	gettimeofday(&ahora, NULL);
+	return (long long)ahora.tv_sec * 1000 + ahora.tv_usec / 1000;
+}
 
-	char linea[256];
-	char nombre[30], isbn[30], estadoActual, fecha[12];
-	int encontrado = 0, cambiado = 0, ejemplares, ejemplar;
-	// Recorre el archivo original y escribe las líneas en el archivo temporal
-	while(fgets(linea, sizeof(linea), database.archivo)){		
-		if (sscanf(linea, "%d, %c, %s\n", &ejemplar, &estadoActual, fecha) == 3){
-			if(strcmp(linea, linea_original) == 0 && encontrado && !cambiado) {
-				fputs(linea_nueva, temp);  // Escribe la línea con los cambios
-				cambiado = 1;
-			}else{
-				fputs(linea, temp);  // Escribe la línea original
+// Función que anota un cambio en el diario del fragmento y despierta a su hilo de persistencia.
+// El diario es lo único que hace durable el cambio antes de responder: si la línea no se pudo
+// escribir completa (por ejemplo, con el disco lleno) se quita lo escrito y devuelve -1, y
+// quien hizo el cambio debe deshacerlo y no confirmarlo al cliente.
+int registrarCambio(Fragmento *frag, Libro *libro, Ejemplar *ej) {
+	if (frag->diario != NULL) {
+		// La marca de tiempo permite al seguidor medir su retraso de replicación. La línea se
+		// escribe con write, sin pasar por el búfer de stdio del diario (que siempre está vacío)
+		char linea[128];
+		int largo = snprintf(linea, sizeof(linea), "%s, %d, %c, %s, %lld\n", libro->isbn, ej->numero, ej->estado, ej->fecha, milisegundosActuales());
+		// Con el disco casi lleno write puede escribir solo una parte; se insiste hasta que
+		// termine o devuelva el error real
+		int escritos = 0, n = 0;
+		while (escritos < largo && (n = write(fileno(frag->diario), linea + escritos, largo - escritos)) > 0) {
+			escritos += n;
+		}
+		if (escritos != largo) {
+			if (n == 0) {
+				errno = ENOSPC;
 			}
-		}else if(sscanf(linea, "%29[^,], %29[^,], %d\n", nombre, isbn, &ejemplares) == 3){
-			fputs(linea, temp);  // Escribe la información del libro
-			if(strcmp(isbn, database.isbnLibro) == 0){
-				encontrado = 1;
-			}else{
-				encontrado = 0;
+			perror("No se pudo anotar el cambio en el diario");
+			// Una línea a medias se juntaría con la siguiente: el diario vuelve a su tamaño anterior
+			if (ftruncate(fileno(frag->diario), frag->bytesDiario) != 0) {
+				perror("No se pudo recortar el diario");
+			}
+			return -1;
+		}
+		frag->bytesDiario += largo;
+	}
+	actualizarVista(frag, libro - frag->libros);
+	frag->sucio = 1;
+	// El punto de control se hace cuando el diario llega al umbral o cuando pasa el intervalo
+	if (++frag->lineasDiario == UMBRAL_DIARIO) {
+		pthread_cond_signal(&frag->cambios);
+	}
+	return 0;
+}
+
+// Función que envía la respuesta de una solicitud al pipe de respuestas de su cliente
+// (/tmp/<pipe>_R<pid>). No bloquea: si el cliente ya no está, la respuesta se descarta.
+void responder(const Requerimiento *req, const char *msg) {
+	char fifo_respuestas[64];
+	snprintf(fifo_respuestas, sizeof(fifo_respuestas), "/tmp/%s_R%d", nombrePipe, req->cliente);
+	int fd = open(fifo_respuestas, O_WRONLY | O_NONBLOCK);
+	if (fd == -1 || write(fd, msg, strlen(msg) + 1) == -1) {
+		printf("No se pudo responder al cliente %d: %s", req->cliente, msg);
+	}
+	if (fd != -1) {
+		close(fd);
+	}
+}
+
+// Función que abre sin bloquear el pipe de avisos de un cliente (/tmp/<pipe>_A<pid>).
+// Devuelve -1 si el cliente ya no lo tiene abierto (terminó o lo eliminó al salir).
+int abrirAvisos(int cliente) {
+	char fifo_avisos[64];
+	snprintf(fifo_avisos, sizeof(fifo_avisos), "/tmp/%s_A%d", nombrePipe, cliente);
+	return open(fifo_avisos, O_WRONLY | O_NONBLOCK);
+}
+
+// Función que quita la reserva r (anterior es la que la precede) de la lista de espera de un
+// libro y la devuelve al bloque del fragmento
+void quitarReserva(Fragmento *frag, Libro *libro, Reserva *anterior, Reserva *r) {
+	if (anterior != NULL) {
+		anterior->siguiente = r->siguiente;
+	} else {
+		libro->primera = r->siguiente;
+	}
+	if (libro->ultima == r) {
+		libro->ultima = anterior;
+	}
+	r->siguiente = frag->libres;
+	frag->libres = r;
+}
+
+// Función que presta un ejemplar devuelto o ingresado al primero de la lista de espera que
+// todavía escuche sus avisos (con el candado tomado). El préstamo se anota en el diario antes
+// de escribir el aviso; si el aviso no llega, la reserva se descarta y se intenta con la
+// siguiente (la línea siguiente del diario reemplaza a la anterior). Devuelve 1 si el ejemplar
+// quedó prestado, 0 si nadie lo espera y -1 si no se pudo anotar en el diario: el ejemplar
+// vuelve a su estado anterior y la reserva conserva su lugar.
+int asignarAEspera(Fragmento *frag, Libro *libro, Ejemplar *ej) {
+	char fecha[12], aviso[256], fechaAnterior[12];
+	char estadoAnterior = ej->estado;
+	strcpy(fechaAnterior, ej->fecha);
+	obtenerFechaFutura(fecha, sizeof(fecha));
+	snprintf(aviso, sizeof(aviso), "Aviso: el libro %s que reservo le fue prestado, debe devolverlo antes del %s\n", libro->nombre, fecha);
+	ssize_t largo = strlen(aviso);
+
+	while (libro->primera != NULL) {
+		int cliente = libro->primera->cliente;
+
+		// El pipe no bloquea, así que escribir con el candado tomado no detiene el fragmento
+		int fd = abrirAvisos(cliente);
+		if (fd != -1) {
+			ej->estado = 'P';
+			strcpy(ej->fecha, fecha);
+			if (registrarCambio(frag, libro, ej) != 0) {
+				ej->estado = estadoAnterior;
+				strcpy(ej->fecha, fechaAnterior);
+				close(fd);
+				return -1;
 			}
-		} 
+		}
+		quitarReserva(frag, libro, NULL, libro->primera);
+		int avisado = fd != -1 && write(fd, aviso, largo) == largo;
+		if (fd != -1) {
+			close(fd);
+		}
+		if (avisado) {
+			return 1;
+		}
+		printf("No se pudo avisar al cliente %d, se descarta su reserva del libro %s\n", cliente, libro->nombre);
 	}
+	return 0;
+}
 
-	fclose(temp);  // Cierra el archivo temporal
+// Función que elimina las reservas de un cliente que terminó (operación 'Q')
+void cancelarReservas(int cliente) {
+	for (int f = 0; f < numFragmentos; f++) {
+		Fragmento *frag = &fragmentos[f];
+		pthread_mutex_lock(&frag->candado);
+		for (int i = 0; i < frag->numLibros; i++) {
+			Libro *libro = &frag->libros[i];
+			Reserva *anterior = NULL, *r = libro->primera;
+			while (r != NULL) {
+				Reserva *siguiente = r->siguiente;
+				if (r->cliente == cliente) {
+					quitarReserva(frag, libro, anterior, r);
+				} else {
+					anterior = r;
+				}
+				r = siguiente;
+			}
+		}
+		pthread_mutex_unlock(&frag->candado);
+	}
+}
 
-	remove(database.file_name);  // Elimina el archivo original
-	rename("temp.txt", database.file_name);  // Renombra el archivo temporal al nombre original
+// Función que cambia la fecha de devolución de un libro ('D' devolver, 'R' renovar). Devuelve 1
+// si cambió un ejemplar prestado, 0 si el libro no tiene ejemplares prestados, -1 si no existe
+// y -2 si el cambio no se pudo anotar en el diario (el ejemplar queda como estaba).
+int cambiarFecha(Requerimiento req) {
+	int resultado = 0;
+	Fragmento *frag = fragmentoDe(req.isbn);
+	pthread_mutex_lock(&frag->candado);
+
+	Libro *libro = buscarLibro(frag, req.isbn);
+	if (libro == NULL) {
+		resultado = -1;
+	}
+	for (int i = 0; libro != NULL && i < libro->ejemplares; i++) {
+		Ejemplar *ej = &libro->lista[i];
+		if (ej->estado == 'P') {
+			char fechaAnterior[12];
+			strcpy(fechaAnterior, ej->fecha);
+			resultado = 1;
+			if (req.operacion == 'R') {	// Si es renovación, la entrega pasa a 7 días desde hoy
+				obtenerFechaFutura(ej->fecha, sizeof(ej->fecha));
+				if (registrarCambio(frag, libro, ej) != 0) {
+					resultado = -2;
+				}
+			} else {
+				int asignado = asignarAEspera(frag, libro, ej);
+				if (asignado == -1) {
+					resultado = -2;
+				} else if (asignado == 0) {	// Si nadie lo espera, queda disponible con la fecha actual
+					time_t ahora = time(NULL);
+					struct tm hoy;
+					localtime_r(&ahora, &hoy);
+					strftime(ej->fecha, sizeof(ej->fecha), "%d-%m-%Y", &hoy);
+					ej->estado = 'D';
+					if (registrarCambio(frag, libro, ej) != 0) {
+						resultado = -2;
+					}
+				}
+			}
+			// Si el cambio no quedó en el diario el ejemplar sigue prestado como antes
+			if (resultado == -2) {
+				ej->estado = 'P';
+				strcpy(ej->fecha, fechaAnterior);
+			}
+			break;
+		}
+	}
 
-	database.archivo = fopen(database.file_name, "r+");  // Reabre el archivo original para su edición
-	if(database.archivo == NULL) {
-		perror("No se pudo abrir el archivo");
-		return;
+	pthread_mutex_unlock(&frag->candado);
+	return resultado;
+}
+
+// Función que aplica una devolución o renovación y responde al cliente
+void gestionarDevolucion(Requerimiento req) {
+	char msg[256];  // Mensaje de respuesta (en la pila: sin reservas de memoria por solicitud)
+	int resultado = cambiarFecha(req);
+	if (resultado == -1) {
+		snprintf(msg, sizeof(msg), "El libro %s no existe en el catalogo.\n", req.nombre);
+	} else if (resultado == -2) {
+		snprintf(msg, sizeof(msg), "No se pudo registrar la %s del libro %s, intente de nuevo mas tarde.\n",
+		         req.operacion == 'D' ? "devolucion" : "renovacion", req.nombre);
+	} else if (resultado == 0) {
+		snprintf(msg, sizeof(msg), "El libro %s no tiene ejemplares prestados.\n", req.nombre);
+	} else if (req.operacion == 'D') {
+		snprintf(msg, sizeof(msg), "La biblioteca esta recibiendo el libro %s\n", req.nombre);
+	} else {
+		char nueva_fecha_str[12];
+		obtenerFechaFutura(nueva_fecha_str, sizeof(nueva_fecha_str));  // Misma fecha que la del ejemplar renovado
+		snprintf(msg, sizeof(msg), "La biblioteca ha renovado la fecha de entrega del libro %s, entreguelo antes del %s\n", req.nombre, nueva_fecha_str);
 	}
+	responder(&req, msg);
 }
 
 // Implementación de la nueva función para gestionar requerimientos 'P'
-void gestionarPrestamo(Requerimiento req, int fd_SC) {
-    char estadoActual, fecha[12];
-    char *nueva_fecha_str = obtenerFechaFutura();
-    int ejemplar, encontrado = 0;
-    char linea[256], nueva_linea[256] = "";
-
-    database.archivo = fopen(database.file_name,"r+");
-    if(database.archivo == NULL){
-        perror("No se pudo abrir el archivo");
-        return;
+void gestionarPrestamo(Requerimiento req) {
+    char nueva_fecha_str[12];
+    obtenerFechaFutura(nueva_fecha_str, sizeof(nueva_fecha_str));
+    int encontrado = 0;
+
+    Fragmento *frag = fragmentoDe(req.isbn);
+    pthread_mutex_lock(&frag->candado);
+
+    Libro *libro = buscarLibro(frag, req.isbn);
+    for (int i = 0; libro != NULL && i < libro->ejemplares; i++) {
+        Ejemplar *ej = &libro->lista[i];
+        if (ej->estado == 'D') {
+            char fechaAnterior[12];
+            strcpy(fechaAnterior, ej->fecha);
+            encontrado = 1;
+            ej->estado = 'P';
+            strcpy(ej->fecha, nueva_fecha_str);
+            if (registrarCambio(frag, libro, ej) != 0) {
+                // Sin la línea en el diario el préstamo no es durable: se deshace y no se confirma
+                ej->estado = 'D';
+                strcpy(ej->fecha, fechaAnterior);
+                encontrado = -1;
+            }
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&frag->candado);
+
+    char msg[256];
+    if(encontrado == -1) {
+        snprintf(msg, sizeof(msg), "No se pudo registrar el prestamo del libro %s, intente de nuevo mas tarde.\n", req.nombre);
+    }else if(encontrado) {
+        // Responde al cliente indicando que el libro está disponible
+        snprintf(msg, sizeof(msg), "El libro %s se encuentra disponible, debe devolverlo antes del %s\n", req.nombre, nueva_fecha_str);
+    }else {
+        snprintf(msg, sizeof(msg), "El libro %s no se encuentra disponible.\n", req.nombre);
     }
 
-    int cantidad = buscarLibro(req.isbn);
-    strcpy(database.isbnLibro, req.isbn);
+    // Envía la respuesta al PS
+    responder(&req, msg);
+}
+
+// Función que agrega al cliente a la lista de espera de un libro sin ejemplares disponibles
+void gestionarReserva(Requerimiento req) {
+    int disponible = 0, posicion = 0;
+
+    Fragmento *frag = fragmentoDe(req.isbn);
+    pthread_mutex_lock(&frag->candado);
 
-    while(cantidad > 0 && fgets(linea, sizeof(linea), database.archivo) && !encontrado) {
-        if(sscanf(linea, "%d, %c, %s\n", &ejemplar, &estadoActual, fecha) == 3) {
-            if(estadoActual == 'D') {
-                encontrado = 1;
-                estadoActual = 'P';
-                snprintf(nueva_linea, sizeof(nueva_linea), "%d, %c, %s\n", ejemplar, estadoActual, nueva_fecha_str);
-                break;
+    Libro *libro = buscarLibro(frag, req.isbn);
+    for (int i = 0; libro != NULL && i < libro->ejemplares; i++) {
+        if (libro->lista[i].estado == 'D') {
+            disponible = 1;
+            break;
+        }
+    }
+
+    if (libro != NULL && !disponible) {
+        // Si el cliente ya está en la lista conserva su lugar. Las reservas de clientes que
+        // ya no escuchan sus avisos se descartan para que no ocupen lugares en la lista.
+        Reserva *anterior = NULL, *r = libro->primera;
+        posicion = 1;
+        while (r != NULL && r->cliente != req.cliente) {
+            Reserva *siguiente = r->siguiente;
+            int fd = abrirAvisos(r->cliente);
+            if (fd == -1) {
+                quitarReserva(frag, libro, anterior, r);
+            } else {
+                close(fd);
+                anterior = r;
+                posicion++;
+            }
+            r = siguiente;
+        }
+        if (r == NULL) {
+            // Toma una reserva del bloque del fragmento (no reserva memoria por solicitud)
+            r = frag->libres;
+            if (r == NULL) {
+                posicion = 0;
+            } else {
+                frag->libres = r->siguiente;
+                r->cliente = req.cliente;
+                r->siguiente = NULL;
+                if (libro->ultima != NULL) {
+                    libro->ultima->siguiente = r;
+                } else {
+                    libro->primera = r;
+                }
+                libro->ultima = r;
             }
         }
-        cantidad--;
     }
 
-    char *msg = (char *)malloc(256 * sizeof(char));
-    // Si se encontró el libro, reescribe la línea con la nueva fecha
-    if(encontrado) {
-        reescribirArchivo(linea, nueva_linea);
-        // Responde al cliente indicando que el libro está disponible
-        sprintf(msg, "El libro %s se encuentra disponible, debe devolverlo antes del %s\n", req.nombre, nueva_fecha_str);
-    }else {
-        sprintf(msg, "El libro %s no se encuentra disponible.\n", req.nombre);
+    pthread_mutex_unlock(&frag->candado);
+
+    char msg[256];
+    if (libro == NULL) {
+        snprintf(msg, sizeof(msg), "El libro %s no existe en el catalogo.\n", req.nombre);
+    } else if (disponible) {
+        snprintf(msg, sizeof(msg), "El libro %s se encuentra disponible, solicite el prestamo.\n", req.nombre);
+    } else if (posicion == 0) {
+        snprintf(msg, sizeof(msg), "No se pudo reservar el libro %s, las listas de espera estan llenas.\n", req.nombre);
+    } else {
+        snprintf(msg, sizeof(msg), "El libro %s fue reservado, es el numero %d en la lista de espera. Se le avisara cuando se le preste.\n",
+                 req.nombre, posicion);
     }
 
-    fclose(database.archivo);  // Cierra el archivo de la base de datos
+    // Envía la respuesta al PS
+    responder(&req, msg);
+}
+
+// Función que responde con la disponibilidad de un libro sin modificar el catálogo (modo seguidor)
+void responderConsulta(Requerimiento req) {
+    int disponibles = 0, total = 0, encontrado = 0;
+
+    Fragmento *frag = fragmentoDe(req.isbn);
+    pthread_mutex_lock(&frag->candado);
+    Libro *libro = buscarLibro(frag, req.isbn);
+    if (libro != NULL) {
+        encontrado = 1;
+        total = libro->ejemplares;
+        for (int i = 0; i < libro->ejemplares; i++) {
+            if (libro->lista[i].estado == 'D') {
+                disponibles++;
+            }
+        }
+    }
+    pthread_mutex_unlock(&frag->candado);
+
+    char msg[256];
+    if (encontrado) {
+        snprintf(msg, sizeof(msg), "Replica de solo lectura: el libro %s tiene %d de %d ejemplares disponibles (retraso %lld ms)\n",
+                 req.nombre, disponibles, total, retrasoReplicacion());
+    } else {
+        snprintf(msg, sizeof(msg), "Replica de solo lectura: el libro %s no existe en el catalogo\n", req.nombre);
+    }
 
     // Envía la respuesta al PS
-    ssize_t bytes_written = write(fd_SC, msg, strlen(msg) + 1);
-    if(bytes_written == -1){
-        perror("Error escribiendo en el FIFO");
-        close(fd_SC);
-        free(msg);
-        exit(1);
+    responder(&req, msg);
+}
+
+// Función que responde la disponibilidad de un libro desde la vista de su fragmento, sin tomar el candado.
+// Lectura del seqlock: si un escritor cambió algún libro del fragmento mientras se leía, se repite.
+void consultarDisponibilidad(Requerimiento req) {
+    int disponibles = 0, total = 0, proxima = 0, pos = -1;
+
+    Fragmento *frag = fragmentoDe(req.isbn);
+    Vista *vista = atomic_load_explicit(&frag->vista, memory_order_acquire);
+    if (vista != NULL) {
+        pos = buscarEnVista(vista, req.isbn);
+    }
+    if (pos != -1) {
+        Disponibilidad *disp = &vista->libros[pos];
+        unsigned int antes, despues;
+        do {
+            antes = atomic_load_explicit(&frag->secuencia, memory_order_acquire);
+            disponibles = atomic_load_explicit(&disp->disponibles, memory_order_relaxed);
+            total = atomic_load_explicit(&disp->total, memory_order_relaxed);
+            proxima = atomic_load_explicit(&disp->proximaEntrega, memory_order_relaxed);
+            atomic_thread_fence(memory_order_acquire);
+            despues = atomic_load_explicit(&frag->secuencia, memory_order_relaxed);
+        } while ((antes & 1) != 0 || antes != despues);
+    }
+
+    // El seguidor indica que responde con su copia y con cuánto retraso
+    char replica[64] = "";
+    if (seguidor) {
+        snprintf(replica, sizeof(replica), " (replica, retraso %lld ms)", retrasoReplicacion());
     }
-    free(msg);
-}
\ No newline at end of file
+
+    char msg[256];
+    if (pos == -1) {
+        snprintf(msg, sizeof(msg), "El libro %s no existe en el catalogo.\n", req.nombre);
+    } else if (proxima != 0) {
+        snprintf(msg, sizeof(msg), "El libro %s tiene %d de %d ejemplares disponibles, la entrega mas proxima es el %02d-%02d-%04d%s\n",
+                 req.nombre, disponibles, total, proxima % 100, proxima / 100 % 100, proxima / 10000, replica);
+    } else {
+        snprintf(msg, sizeof(msg), "El libro %s tiene %d de %d ejemplares disponibles%s\n", req.nombre, disponibles, total, replica);
+    }
+
+    // Envía la respuesta al PS
+    responder(&req, msg);
+}
+
+// Función que asigna los nombres de archivo y diario del fragmento i de un catálogo de k fragmentos
+void nombrarFragmento(Fragmento *frag, const char *fileDatos, int i, int k) {
+	if (k == 1) {
+		snprintf(frag->file_name, sizeof(frag->file_name), "%s", fileDatos);
+	} else {
+		snprintf(frag->file_name, sizeof(frag->file_name), "%s.%d", fileDatos, i);
+	}
+	snprintf(frag->diario_name, sizeof(frag->diario_name), "%s.diario", frag->file_name);
+}
+
+// Función que lee el encabezado de un diario: posición del fragmento y cantidad de fragmentos
+// del catálogo. Devuelve -1 si el diario no existe o no tiene encabezado.
+int leerEncabezado(const char *ruta, int *indice, int *k) {
+	char linea[96];
+	int libros, ejemplares, leidos = 0;
+	FILE *diario = fopen(ruta, "r");
+	if (diario != NULL) {
+		if (fgets(linea, sizeof(linea), diario) != NULL) {
+			leidos = sscanf(linea, ENCABEZADO_DIARIO, indice, k, &libros, &ejemplares);
+		}
+		fclose(diario);
+	}
+	return leidos == 4 ? 0 : -1;
+}
+
+// Función que obtiene la cantidad de fragmentos de un catálogo en disco, registrada en el
+// encabezado de sus diarios (1 si no está particionado). Un catálogo cuyos diarios todavía
+// no tienen encabezado se cuenta buscando los archivos .0, .1, ...; al abrirlo se escribe.
+int contarFragmentos(const char *fileDatos) {
+	char ruta[96];
+	int indice, k = 0;
+	snprintf(ruta, sizeof(ruta), "%s.diario", fileDatos);
+	if (leerEncabezado(ruta, &indice, &k) == 0 && k == 1) {
+		return 1;
+	}
+	snprintf(ruta, sizeof(ruta), "%s.0.diario", fileDatos);
+	if (leerEncabezado(ruta, &indice, &k) == 0 && k > 1 && k <= MAX_FRAGMENTOS) {
+		return k;
+	}
+	k = 0;
+	while (k < MAX_FRAGMENTOS) {
+		snprintf(ruta, sizeof(ruta), "%s.%d", fileDatos, k);
+		if (access(ruta, F_OK) != 0) {
+			break;
+		}
+		k++;
+	}
+	return k == 0 ? 1 : k;
+}
+
+// Función que verifica que un fragmento cargado corresponda al catálogo abierto: su diario (si
+// tiene encabezado) indica esta posición y esta cantidad de fragmentos, y cada libro está en
+// el fragmento que le asigna el hash de su ISBN. Así un fragmento faltante o sobrante no
+// cambia en silencio el reparto de los libros.
+int verificarFragmento(Fragmento *frag) {
+	int i = (int)(frag - fragmentos), indice, k;
+	if (leerEncabezado(frag->diario_name, &indice, &k) == 0 && (indice != i || k != numFragmentos)) {
+		fprintf(stderr, "Error: El diario %s es del fragmento %d de %d, pero se abrio como el %d de %d.\n",
+		        frag->diario_name, indice, k, i, numFragmentos);
+		return -1;
+	}
+	for (int j = 0; j < frag->numLibros; j++) {
+		Fragmento *propio = fragmentoDe(frag->libros[j].isbn);
+		if (propio != frag) {
+			fprintf(stderr, "Error: El libro %s de %s corresponde al fragmento %d de %d; use -R para reparticionar el catalogo.\n",
+			        frag->libros[j].isbn, frag->file_name, (int)(propio - fragmentos), numFragmentos);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+// Función que agrega un libro al fragmento, ampliando el arreglo si es necesario
+void agregarLibro(Fragmento *frag, const Libro *libro) {
+	if (frag->numLibros == frag->capacidad) {
+		frag->capacidad = frag->capacidad == 0 ? 16 : frag->capacidad * 2;
+		frag->libros = (Libro *)realloc(frag->libros, frag->capacidad * sizeof(Libro));
+		if (frag->libros == NULL) {
+			perror("No se pudo reservar memoria para el catalogo");
+			exit(1);
+		}
+	}
+	frag->libros[frag->numLibros++] = *libro;
+}
+
+// Función que libera la memoria de los libros de un fragmento
+void liberarFragmento(Fragmento *frag) {
+	for (int i = 0; i < frag->numLibros; i++) {
+		free(frag->libros[i].lista);
+	}
+	free(frag->libros);
+	free(frag->indice);
+	frag->indice = NULL;
+	free(frag->reservas);  // Las listas de espera usan reservas de este bloque
+	frag->reservas = frag->libres = NULL;
+	frag->libros = NULL;
+	frag->numLibros = frag->capacidad = 0;
+}
+
+// Función que aplica al fragmento los cambios completos del diario desde la posición actual.
+// Devuelve 1 si llegó al final del diario y 0 si quedó una línea a medio escribir.
+int aplicarDiario(Fragmento *frag, FILE *diario) {
+	char linea[256], isbn[30], estado, fecha[12];
+	int numero;
+	long long marca;
+	long posicion = ftell(diario);
+
+	while (fgets(linea, sizeof(linea), diario)) {
+		// Una línea sin salto todavía se está escribiendo: se releerá en la siguiente pasada
+		if (linea[strlen(linea) - 1] != '\n') {
+			fseek(diario, posicion, SEEK_SET);
+			clearerr(diario);
+			return 0;
+		}
+		posicion = ftell(diario);
+
+		int campos = sscanf(linea, "%29[^,], %d, %c, %11[^,\n], %lld", isbn, &numero, &estado, fecha, &marca);
+		if (campos < 4) {
+			continue;
+		}
+		int pos = posicionLibro(frag, isbn);
+		for (int j = 0; pos != -1 && j < frag->libros[pos].ejemplares; j++) {
+			Ejemplar *ej = &frag->libros[pos].lista[j];
+			if (ej->numero == numero) {
+				ej->estado = estado;
+				strcpy(ej->fecha, fecha);
+				frag->sucio = 1;
+			}
+		}
+		if (pos != -1) {
+			actualizarVista(frag, pos);
+		}
+		// El seguidor recuerda el cambio más antiguo que encontró sin aplicar en esta pasada
+		if (seguidor && campos == 5) {
+			long long desde = atomic_load(&pendienteDesde);
+			if (desde == 0 || marca < desde) {
+				atomic_store(&pendienteDesde, marca);
+			}
+		}
+	}
+	clearerr(diario);
+	return 1;
+}
+
+// Función que lee los libros de un archivo con el formato de la base de datos y los agrega al fragmento
+void leerLibros(FILE *archivo, Fragmento *frag) {
+	char linea[256];
+	Libro libro;
+	// Cada libro es una línea "nombre, isbn, ejemplares" seguida de sus ejemplares
+	while (fgets(linea, sizeof(linea), archivo)) {
+		if (sscanf(linea, "%29[^,], %29[^,], %d", libro.nombre, libro.isbn, &libro.ejemplares) != 3 || libro.ejemplares < 0) {
+			continue;
+		}
+		libro.primera = libro.ultima = NULL;
+		libro.lista = (Ejemplar *)calloc(libro.ejemplares + 1, sizeof(Ejemplar));
+		if (libro.lista == NULL) {
+			perror("No se pudo reservar memoria para el catalogo");
+			exit(1);
+		}
+		int leidos = 0;
+		while (leidos < libro.ejemplares && fgets(linea, sizeof(linea), archivo)) {
+			Ejemplar *ej = &libro.lista[leidos];
+			if (sscanf(linea, "%d, %c, %11s", &ej->numero, &ej->estado, ej->fecha) == 3) {
+				leidos++;
+			}
+		}
+		libro.ejemplares = leidos;
+		agregarLibro(frag, &libro);
+	}
+}
+
+// Función que carga en el fragmento los libros de su archivo y aplica su diario de cambios
+int cargarFragmento(Fragmento *frag) {
+	FILE *archivo = fopen(frag->file_name, "r");
+	if (archivo == NULL) {
+		perror("No se pudo abrir el archivo de base de datos");
+		return -1;
+	}
+	leerLibros(archivo, frag);
+	fclose(archivo);
+	frag->indice = construirIndice(frag->libros, frag->numLibros, frag->numLibros, &frag->tamIndice);
+
+	// Aplica los cambios registrados en el diario después del último guardado
+	// (el seguidor aplica el diario por su cuenta desde el que tiene abierto)
+	FILE *diario = seguidor ? NULL : fopen(frag->diario_name, "r");
+	if (diario != NULL) {
+		aplicarDiario(frag, diario);
+		fclose(diario);
+	}
+	return 0;
+}
+
+// Función que cuenta los ejemplares de un arreglo de libros
+int contarEjemplares(const Libro *libros, int n) {
+	int total = 0;
+	for (int i = 0; i < n; i++) {
+		total += libros[i].ejemplares;
+	}
+	return total;
+}
+
+// Función que copia los libros de un arreglo para escribirlos sin el candado (con el candado tomado)
+void tomarInstantanea(Instantanea *inst, const Libro *libros, int n) {
+	inst->numLibros = n;
+	inst->numEjemplares = contarEjemplares(libros, n);
+	inst->libros = (Libro *)malloc((n + 1) * sizeof(Libro));
+	inst->ejemplares = (Ejemplar *)malloc((inst->numEjemplares + 1) * sizeof(Ejemplar));
+	if (inst->libros == NULL || inst->ejemplares == NULL) {
+		perror("No se pudo reservar memoria para el punto de control");
+		exit(1);
+	}
+	int usados = 0;
+	for (int i = 0; i < n; i++) {
+		inst->libros[i] = libros[i];
+		inst->libros[i].lista = &inst->ejemplares[usados];
+		memcpy(inst->libros[i].lista, libros[i].lista, libros[i].ejemplares * sizeof(Ejemplar));
+		usados += libros[i].ejemplares;
+	}
+}
+
+// Función que libera la copia de un punto de control
+void liberarInstantanea(Instantanea *inst) {
+	free(inst->libros);
+	free(inst->ejemplares);
+	inst->libros = NULL;
+	inst->ejemplares = NULL;
+}
+
+// Función que escribe libros en el archivo temporal indicado con el formato de la base de datos
+// y lo deja en disco. Si algo falla, el temporal se elimina.
+int escribirArchivo(const char *temporal, const Libro *libros, int n) {
+	FILE *temp = fopen(temporal, "w");  // Archivo temporal para escritura
+	if (temp == NULL) {
+		perror("No se pudo abrir archivo temporal");
+		return -1;
+	}
+	int error = 0;
+	for (int i = 0; i < n && !error; i++) {
+		const Libro *libro = &libros[i];
+		error = fprintf(temp, "%s, %s, %d\n", libro->nombre, libro->isbn, libro->ejemplares) < 0;
+		for (int j = 0; j < libro->ejemplares && !error; j++) {
+			error = fprintf(temp, "%d, %c, %s\n", libro->lista[j].numero, libro->lista[j].estado, libro->lista[j].fecha) < 0;
+		}
+	}
+	if (error || fflush(temp) != 0 || fsync(fileno(temp)) != 0) {
+		error = 1;
+	}
+	if (fclose(temp) != 0) {
+		error = 1;
+	}
+
+	// Si algo falló (por ejemplo, el disco está lleno) el archivo anterior y el diario quedan intactos
+	if (error) {
+		perror("No se pudo escribir el punto de control");
+		remove(temporal);
+		return -1;
+	}
+	return 0;
+}
+
+// Función que escribe libros en un archivo con el formato de la base de datos. Se escribe en un
+// temporal que solo reemplaza al archivo si se escribió completo y quedó en disco.
+int escribirLibros(const char *ruta, const Libro *libros, int n) {
+	char temporal[112];
+	snprintf(temporal, sizeof(temporal), "%s.tmp", ruta);
+	if (escribirArchivo(temporal, libros, n) != 0) {
+		return -1;
+	}
+
+	// El renombrado es atómico: el archivo nunca queda a medio escribir
+	if (rename(temporal, ruta) != 0) {
+		perror("No se pudo reemplazar el archivo de base de datos");
+		remove(temporal);
+		return -1;
+	}
+	return 0;
+}
+
+// Función que reemplaza el diario por uno que solo tiene los cambios anotados desde la posición
+// desde (los anteriores ya están en el archivo), con el candado tomado. El encabezado indica
+// la posición del fragmento, la cantidad de fragmentos y cuántos libros y ejemplares tiene el archivo. Se renombra (en vez de truncarlo) para que el
+// seguidor detecte el cambio de inodo.
+int reiniciarDiario(Fragmento *frag, long desde, int libros, int ejemplares) {
+	char temporal[112];
+	snprintf(temporal, sizeof(temporal), "%s.tmp", frag->diario_name);
+
+	int fd = open(temporal, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1) {
+		perror("No se pudo reiniciar el diario");
+		return -1;
+	}
+	char bloque[4096];
+	int largo = snprintf(bloque, sizeof(bloque), ENCABEZADO_DIARIO, (int)(frag - fragmentos), numFragmentos, libros, ejemplares);
+	int error = write(fd, bloque, largo) != largo;
+	long escritos = largo;
+
+	// Copia los cambios posteriores al punto de control (sin diario abierto no hay ninguno)
+	int anterior = frag->diario != NULL ? open(frag->diario_name, O_RDONLY) : -1;
+	if (anterior != -1) {
+		ssize_t leidos;
+		lseek(anterior, desde, SEEK_SET);
+		while (!error && (leidos = read(anterior, bloque, sizeof(bloque))) > 0) {
+			error = write(fd, bloque, leidos) != leidos;
+			escritos += leidos;
+		}
+		close(anterior);
+	}
+	if (error || fsync(fd) != 0 || rename(temporal, frag->diario_name) != 0) {
+		perror("No se pudo reiniciar el diario");
+		close(fd);
+		remove(temporal);
+		return -1;
+	}
+
+	if (frag->diario != NULL) {
+		fclose(frag->diario);  // Libera el búfer del diario antes de asignarlo al nuevo
+		frag->diario = fdopen(fd, "a");
+		if (frag->diario == NULL) {
+			perror("No se pudo abrir el diario");
+			close(fd);
+			return -1;
+		}
+		setvbuf(frag->diario, frag->bufferDiario, _IOFBF, sizeof(frag->bufferDiario));
+	} else {
+		close(fd);
+	}
+	frag->bytesDiario = escritos;
+	return 0;
+}
+
+// Función que hace un punto de control del fragmento: copia los libros con el candado tomado,
+// los escribe en el archivo sin el candado y deja en el diario solo los cambios posteriores a la copia
+int guardarFragmento(Fragmento *frag) {
+	Instantanea inst;
+	pthread_mutex_lock(&frag->candadoPunto);
+	pthread_mutex_lock(&frag->candado);
+	tomarInstantanea(&inst, frag->libros, frag->numLibros);
+	long desde = frag->bytesDiario;
+	int lineas = frag->lineasDiario;
+	frag->sucio = 0;
+	pthread_mutex_unlock(&frag->candado);
+
+	int resultado = escribirLibros(frag->file_name, inst.libros, inst.numLibros);
+
+	pthread_mutex_lock(&frag->candado);
+	if (resultado == 0) {
+		resultado = reiniciarDiario(frag, desde, inst.numLibros, inst.numEjemplares);
+	}
+	if (resultado == 0) {
+		frag->lineasDiario -= lineas;
+	} else {
+		frag->sucio = 1;  // El diario conserva los cambios: se reintenta en el siguiente intervalo
+	}
+	pthread_mutex_unlock(&frag->candado);
+	pthread_mutex_unlock(&frag->candadoPunto);
+	liberarInstantanea(&inst);
+	return resultado;
+}
+
+// Función del hilo de persistencia: hace un punto de control cuando el diario llega a
+// UMBRAL_DIARIO cambios, cuando pasan INTERVALO_PUNTO segundos con cambios o al terminar
+void* persistirFragmento(void *arg) {
+	Fragmento *frag = (Fragmento *)arg;
+	int terminar = 0, fallo = 0;
+
+	while (!terminar) {
+		struct timespec limite;
+		clock_gettime(CLOCK_REALTIME, &limite);
+		limite.tv_sec += INTERVALO_PUNTO;
+
+		// Después de un punto de control fallido se espera el intervalo completo para reintentar
+		pthread_mutex_lock(&frag->candado);
+		while (!frag->terminar && (fallo || frag->lineasDiario < UMBRAL_DIARIO)) {
+			if (pthread_cond_timedwait(&frag->cambios, &frag->candado, &limite) == ETIMEDOUT) {
+				break;
+			}
+		}
+		int guardar = frag->sucio;
+		terminar = frag->terminar;
+		pthread_mutex_unlock(&frag->candado);
+
+		if (guardar) {
+			fallo = guardarFragmento(frag) != 0;
+		}
+	}
+	return NULL;
+}
+
+// Función que copia al arreglo nuevo de un ingreso el estado actual de los libros del fragmento,
+// con los ejemplares actuales de los libros que reciben ejemplares nuevos (con el candado tomado)
+void copiarEstadoActual(Fragmento *frag, Libro *nuevos, int n, Fusion *fusiones, int numFusiones) {
+	memcpy(nuevos, frag->libros, n * sizeof(Libro));
+	for (int i = 0; i < numFusiones; i++) {
+		Fusion *fusion = &fusiones[i];
+		memcpy(fusion->lista, frag->libros[fusion->pos].lista, fusion->actuales * sizeof(Ejemplar));
+		nuevos[fusion->pos].lista = fusion->lista;
+		nuevos[fusion->pos].ejemplares = fusion->total;
+	}
+}
+
+// Función que ingresa al catálogo los libros y ejemplares de un archivo sin detener el servidor.
+// Las tablas nuevas de cada fragmento se construyen fuera del candado, se guardan en el archivo
+// del fragmento y se publican con un solo cambio de apuntador; el candado solo se toma para
+// copiar el estado actual y publicar.
+int ingresarLibros(const char *ruta, char *resumen, size_t tam) {
+	long long inicio = milisegundosActuales();
+	FILE *archivo = fopen(ruta, "r");
+	if (archivo == NULL) {
+		snprintf(resumen, tam, "No se pudo abrir el archivo de ingreso %s\n", ruta);
+		return -1;
+	}
+
+	pthread_mutex_lock(&candadoIngreso);  // Solo un ingreso a la vez cambia los arreglos de libros
+	if (!continuar) {
+		// El catálogo se está cerrando: los fragmentos pueden estar liberados
+		pthread_mutex_unlock(&candadoIngreso);
+		fclose(archivo);
+		snprintf(resumen, tam, "Ingreso de %s cancelado: el servidor esta terminando\n", ruta);
+		return -1;
+	}
+
+	Fragmento leidos = {0};
+	leerLibros(archivo, &leidos);
+	fclose(archivo);
+
+	int librosNuevos = 0, ejemplaresNuevos = 0, fallidos = 0;
+	Vista *retiradas[MAX_FRAGMENTOS];  // Vistas reemplazadas, que se liberan juntas al final
+	int numRetiradas = 0;
+	for (int f = 0; f < numFragmentos; f++) {
+		Fragmento *frag = &fragmentos[f];
+		int m = 0;
+		for (int i = 0; i < leidos.numLibros; i++) {
+			if (fragmentoDe(leidos.libros[i].isbn) == frag) {
+				m++;
+			}
+		}
+		if (m == 0) {
+			continue;
+		}
+
+		// Copia del arreglo actual (la cantidad de libros solo cambia con un ingreso)
+		int n = frag->numLibros, total = n, capacidad = n + m, tamIndice;
+		Libro *nuevos = (Libro *)malloc(capacidad * sizeof(Libro));
+		Fusion *fusiones = (Fusion *)malloc(m * sizeof(Fusion));
+		int *fusionDe = (int *)calloc(n + 1, sizeof(int));
+		if (nuevos == NULL || fusiones == NULL || fusionDe == NULL) {
+			perror("No se pudo reservar memoria para el ingreso");
+			exit(1);
+		}
+		pthread_mutex_lock(&frag->candado);
+		memcpy(nuevos, frag->libros, n * sizeof(Libro));
+		pthread_mutex_unlock(&frag->candado);
+		int *indice = construirIndice(nuevos, n, capacidad, &tamIndice);
+		int numFusiones = 0, librosFragmento = 0, ejemplaresFragmento = 0;
+
+		for (int i = 0; i < leidos.numLibros; i++) {
+			Libro *leido = &leidos.libros[i];
+			if (fragmentoDe(leido->isbn) != frag) {
+				continue;
+			}
+			ejemplaresFragmento += leido->ejemplares;
+			int pos = buscarEnIndice(indice, tamIndice, nuevos, leido->isbn);
+
+			if (pos == -1) {	// Libro nuevo: pasa tal cual al arreglo nuevo
+				nuevos[total] = *leido;
+				leido->lista = NULL;
+				indexarLibro(indice, tamIndice, nuevos, total);
+				total++;
+				librosFragmento++;
+				continue;
+			}
+
+			// Libro existente: sus ejemplares nuevos se numeran a continuación de los actuales
+			Ejemplar *lista;
+			int ejemplares;
+			if (pos >= n) {
+				lista = nuevos[pos].lista;
+				ejemplares = nuevos[pos].ejemplares;
+			} else if (fusionDe[pos] != 0) {
+				lista = fusiones[fusionDe[pos] - 1].lista;
+				ejemplares = fusiones[fusionDe[pos] - 1].total;
+			} else {
+				lista = NULL;
+				ejemplares = nuevos[pos].ejemplares;
+			}
+			lista = (Ejemplar *)realloc(lista, (ejemplares + leido->ejemplares + 1) * sizeof(Ejemplar));
+			if (lista == NULL) {
+				perror("No se pudo reservar memoria para el ingreso");
+				exit(1);
+			}
+			int ultimo = 0;
+			Ejemplar *actuales = pos < n ? frag->libros[pos].lista : lista;
+			int cuantos = pos < n ? nuevos[pos].ejemplares : ejemplares;
+			for (int j = 0; j < cuantos; j++) {
+				if (actuales[j].numero > ultimo) {
+					ultimo = actuales[j].numero;  // El número de un ejemplar no cambia después de creado
+				}
+			}
+			for (int j = cuantos; j < ejemplares; j++) {
+				if (lista[j].numero > ultimo) {
+					ultimo = lista[j].numero;
+				}
+			}
+			for (int j = 0; j < leido->ejemplares; j++) {
+				lista[ejemplares + j] = leido->lista[j];
+				lista[ejemplares + j].numero = ++ultimo;
+			}
+			ejemplares += leido->ejemplares;
+
+			if (pos >= n) {
+				nuevos[pos].lista = lista;
+				nuevos[pos].ejemplares = ejemplares;
+			} else {
+				if (fusionDe[pos] == 0) {
+					fusiones[numFusiones].pos = pos;
+					fusiones[numFusiones].actuales = nuevos[pos].ejemplares;
+					fusionDe[pos] = ++numFusiones;
+				}
+				fusiones[fusionDe[pos] - 1].lista = lista;
+				fusiones[fusionDe[pos] - 1].total = ejemplares;
+			}
+		}
+
+		// Vista de consultas del arreglo nuevo: los libros nuevos se resumen aquí y los actuales al publicar
+		Vista *vista = construirVista(nuevos, total);
+		for (int i = n; i < total; i++) {
+			llenarDisponibilidad(&vista->libros[i], &nuevos[i]);
+		}
+
+		// Punto de control con los libros nuevos antes de publicarlos: los cambios que se anoten
+		// en el diario sobre ellos siempre encuentran sus libros y ejemplares en el archivo. El
+		// candado del punto de control evita que el hilo de persistencia escriba el arreglo anterior.
+		pthread_mutex_lock(&frag->candadoPunto);
+		Instantanea inst;
+		pthread_mutex_lock(&frag->candado);
+		copiarEstadoActual(frag, nuevos, n, fusiones, numFusiones);
+		tomarInstantanea(&inst, nuevos, total);
+		long desde = frag->bytesDiario;
+		int lineas = frag->lineasDiario;
+		pthread_mutex_unlock(&frag->candado);
+
+		if (escribirLibros(frag->file_name, inst.libros, inst.numLibros) != 0) {
+			// Sin el archivo en disco el ingreso de este fragmento se descarta
+			pthread_mutex_unlock(&frag->candadoPunto);
+			liberarInstantanea(&inst);
+			for (int i = 0; i < numFusiones; i++) {
+				free(fusiones[i].lista);
+			}
+			for (int i = n; i < total; i++) {
+				free(nuevos[i].lista);
+			}
+			free(nuevos);
+			free(indice);
+			liberarVista(vista);
+			free(fusiones);
+			free(fusionDe);
+			fallidos++;
+			continue;
+		}
+
+		// Publica el arreglo nuevo: copia otra vez el estado actual (pudo cambiar durante la
+		// escritura) y cambia el apuntador
+		pthread_mutex_lock(&frag->candado);
+		copiarEstadoActual(frag, nuevos, n, fusiones, numFusiones);
+		Vista *vistaVieja = atomic_load_explicit(&frag->vista, memory_order_relaxed);
+		for (int i = 0; i < n; i++) {
+			Disponibilidad *antes = &vistaVieja->libros[i], *ahora = &vista->libros[i];
+			atomic_store_explicit(&ahora->disponibles, atomic_load_explicit(&antes->disponibles, memory_order_relaxed), memory_order_relaxed);
+			atomic_store_explicit(&ahora->total, atomic_load_explicit(&antes->total, memory_order_relaxed), memory_order_relaxed);
+			atomic_store_explicit(&ahora->proximaEntrega, atomic_load_explicit(&antes->proximaEntrega, memory_order_relaxed), memory_order_relaxed);
+		}
+		for (int i = 0; i < numFusiones; i++) {
+			llenarDisponibilidad(&vista->libros[fusiones[i].pos], &nuevos[fusiones[i].pos]);
+		}
+		atomic_store_explicit(&frag->vista, vista, memory_order_release);
+		Libro *viejos = frag->libros;
+		int *indiceViejo = frag->indice;
+		frag->libros = nuevos;
+		frag->numLibros = total;
+		frag->capacidad = capacidad;
+		frag->indice = indice;
+		frag->tamIndice = tamIndice;
+
+		// El diario queda con los cambios posteriores a la copia (si falla, conserva todos,
+		// que aplicados sobre el archivo nuevo dan el mismo resultado)
+		if (reiniciarDiario(frag, desde, inst.numLibros, inst.numEjemplares) == 0) {
+			frag->lineasDiario -= lineas;
+		}
+
+		// Los ejemplares nuevos disponibles de un libro con lista de espera se prestan a quienes
+		// lo esperan, igual que un ejemplar devuelto (si el diario falla, quedan disponibles)
+		for (int i = 0; i < numFusiones; i++) {
+			Libro *libro = &frag->libros[fusiones[i].pos];
+			for (int j = fusiones[i].actuales; j < libro->ejemplares && libro->primera != NULL; j++) {
+				if (libro->lista[j].estado == 'D') {
+					asignarAEspera(frag, libro, &libro->lista[j]);
+				}
+			}
+		}
+		pthread_mutex_unlock(&frag->candado);
+		pthread_mutex_unlock(&frag->candadoPunto);
+		librosNuevos += librosFragmento;
+		ejemplaresNuevos += ejemplaresFragmento;
+
+		liberarInstantanea(&inst);
+		for (int i = 0; i < numFusiones; i++) {
+			free(viejos[fusiones[i].pos].lista);
+		}
+		free(viejos);
+		free(indiceViejo);
+		retiradas[numRetiradas++] = vistaVieja;  // Se libera al final, cuando el lector no la pueda estar usando
+		free(fusiones);
+		free(fusionDe);
+	}
+
+	pthread_mutex_unlock(&candadoIngreso);
+	retirarVistas(retiradas, numRetiradas);
+	liberarFragmento(&leidos);  // Solo quedan las listas de los libros que se fusionaron
+
+	long long duracion = milisegundosActuales() - inicio;
+	if (fallidos > 0) {
+		snprintf(resumen, tam, "Ingreso de %s incompleto: %d fragmentos no se pudieron guardar; %d libros nuevos y %d ejemplares agregados\n",
+		         ruta, fallidos, librosNuevos, ejemplaresNuevos);
+		return -1;
+	}
+	snprintf(resumen, tam, "Ingreso de %s: %d libros nuevos y %d ejemplares agregados en %lld ms (%.0f ejemplares/s)\n",
+	         ruta, librosNuevos, ejemplaresNuevos, duracion, duracion > 0 ? ejemplaresNuevos * 1000.0 / duracion : (double)ejemplaresNuevos * 1000);
+	return 0;
+}
+
+// Función del hilo que atiende un ingreso pedido con la operación 'A'
+void* ingresarEnSegundoPlano(void *arg) {
+	char *ruta = (char *)arg;
+	char resumen[256];
+	ingresarLibros(ruta, resumen, sizeof(resumen));
+	printf("%s", resumen);
+	free(ruta);
+	return NULL;
+}
+
+// Función que pone al día un fragmento del seguidor con el diario del principal. Deja en vieja
+// la vista que reemplazó si recargó el archivo (o NULL), para retirarla al terminar la pasada.
+// Devuelve 1 si llegó al final del diario y 0 si no lo pudo leer completo.
+int seguirFragmento(Fragmento *frag, Vista **vieja) {
+	*vieja = NULL;
+	struct stat info;
+	if (stat(frag->diario_name, &info) != 0) {
+		return 0;
+	}
+
+	int alDia = 0;
+	pthread_mutex_lock(&frag->candado);
+	if (frag->diario != NULL && info.st_ino == frag->inodo) {
+		alDia = aplicarDiario(frag, frag->diario);  // Mismo diario: aplica lo que se haya agregado
+	} else {
+		// El principal hizo un punto de control: se termina el diario anterior y se abre
+		// el nuevo, que empieza con los cambios posteriores a la copia (ya aplicados, y
+		// aplicarlos otra vez no cambia nada). Solo se recarga el archivo si su encabezado
+		// indica libros o ejemplares que el seguidor no tiene (un ingreso) o al iniciar.
+		int recargar = frag->diario == NULL;
+		if (frag->diario != NULL) {
+			aplicarDiario(frag, frag->diario);
+			fclose(frag->diario);
+		}
+		frag->diario = fopen(frag->diario_name, "r");
+		if (frag->diario != NULL && !recargar) {
+			int indice, k, libros, ejemplares;
+			char linea[96];
+			if (fgets(linea, sizeof(linea), frag->diario) == NULL ||
+			    sscanf(linea, ENCABEZADO_DIARIO, &indice, &k, &libros, &ejemplares) != 4 ||
+			    libros != frag->numLibros || ejemplares != contarEjemplares(frag->libros, frag->numLibros)) {
+				recargar = 1;
+				rewind(frag->diario);
+			}
+		}
+		if (frag->diario != NULL && fstat(fileno(frag->diario), &info) == 0) {
+			frag->inodo = info.st_ino;
+		}
+		if (frag->diario != NULL && !recargar) {
+			alDia = aplicarDiario(frag, frag->diario);
+		} else if (frag->diario != NULL) {
+			// El diario nuevo se abre antes de leer el archivo para no perder cambios
+			// escritos entre ambas lecturas
+			liberarFragmento(frag);
+			int cargado = cargarFragmento(frag);
+			*vieja = publicarVista(frag);  // Las posiciones de los libros cambian con la recarga
+			if (cargado == 0) {
+				alDia = aplicarDiario(frag, frag->diario);
+			}
+		}
+	}
+	frag->sucio = 0;
+	pthread_mutex_unlock(&frag->candado);
+	return alDia;
+}
+
+// Función que calcula el retraso de replicación del seguidor en ms: el tiempo desde el cambio
+// más antiguo del principal que no tenía aplicado, o 0 si la última pasada llegó al final de
+// todos los diarios
+long long retrasoReplicacion() {
+	long long desde = atomic_load(&pendienteDesde);
+	return desde == 0 ? 0 : milisegundosActuales() - desde;
+}
+
+// Función del hilo seguidor: revisa periódicamente los diarios del principal. Mientras una
+// pasada no termina, el retraso cuenta desde el cambio más antiguo que encontró; si una pasada
+// no puede leer algún diario completo, cuenta por lo menos desde la última pasada al día.
+void* seguirCatalogo(void *arg) {
+	Vista *retiradas[MAX_FRAGMENTOS];
+	long long ultimaAlDia = milisegundosActuales();
+	while (continuar) {
+		long long inicio = milisegundosActuales();
+		int alDia = 1;
+		for (int i = 0; i < numFragmentos; i++) {
+			alDia &= seguirFragmento(&fragmentos[i], &retiradas[i]);
+		}
+		retirarVistas(retiradas, numFragmentos);
+		if (alDia) {
+			atomic_store(&pendienteDesde, 0);
+			ultimaAlDia = inicio;
+		} else {
+			long long desde = atomic_load(&pendienteDesde);
+			if (desde == 0 || ultimaAlDia < desde) {
+				atomic_store(&pendienteDesde, ultimaAlDia);
+			}
+		}
+		usleep(50000);
+	}
+	return NULL;
+}
+
+// Función que crea un diario vacío (solo con su encabezado) y lo deja en disco
+int crearDiario(const char *ruta, int indice, int k, int libros, int ejemplares) {
+	int fd = open(ruta, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1) {
+		perror("No se pudo crear el diario");
+		return -1;
+	}
+	char encabezado[96];
+	int largo = snprintf(encabezado, sizeof(encabezado), ENCABEZADO_DIARIO, indice, k, libros, ejemplares);
+	int error = write(fd, encabezado, largo) != largo || fsync(fd) != 0;
+	if (close(fd) != 0 || error) {
+		perror("No se pudo crear el diario");
+		remove(ruta);
+		return -1;
+	}
+	return 0;
+}
+
+// Función que deja en disco las entradas del directorio de un archivo (creados, renombrados, eliminados)
+int sincronizarDirectorio(const char *ruta) {
+	char directorio[96];
+	snprintf(directorio, sizeof(directorio), "%s", ruta);
+	char *barra = strrchr(directorio, '/');
+	if (barra == NULL) {
+		snprintf(directorio, sizeof(directorio), ".");
+	} else if (barra == directorio) {
+		barra[1] = '\0';
+	} else {
+		*barra = '\0';
+	}
+	int fd = open(directorio, O_RDONLY);
+	if (fd == -1) {
+		return -1;
+	}
+	int resultado = fsync(fd);
+	close(fd);
+	return resultado;
+}
+
+// Función que elimina los archivos temporales (.nuevo) de un reparto en k fragmentos
+void quitarRepartoNuevo(const char *fileDatos, int k) {
+	Fragmento nombres;
+	char ruta[112];
+	for (int i = 0; i < k; i++) {
+		nombrarFragmento(&nombres, fileDatos, i, k);
+		snprintf(ruta, sizeof(ruta), "%s.nuevo", nombres.file_name);
+		remove(ruta);
+		snprintf(ruta, sizeof(ruta), "%s.nuevo", nombres.diario_name);
+		remove(ruta);
+	}
+}
+
+// Función que termina un reparto cuya marca (<archivo>.reparto) quedó en disco: los fragmentos
+// y diarios nuevos ya están completos con nombre .nuevo, así que se cambian por los anteriores
+// y se eliminan los fragmentos que ya no forman parte del catálogo. Repetirla no cambia nada,
+// por lo que un reparto interrumpido por una caída se termina al volver a iniciar.
+int completarReparto(const char *fileDatos) {
+	char marca[96], ruta[112];
+	int k, existentes;
+	snprintf(marca, sizeof(marca), "%s.reparto", fileDatos);
+	FILE *archivo = fopen(marca, "r");
+	if (archivo == NULL) {
+		return 0;  // No hay un reparto pendiente
+	}
+	int leidos = fscanf(archivo, "%d %d", &k, &existentes);
+	fclose(archivo);
+	if (leidos != 2 || k < 1 || k > MAX_FRAGMENTOS || existentes < 1 || existentes > MAX_FRAGMENTOS) {
+		fprintf(stderr, "Error: La marca de reparto %s no es valida.\n", marca);
+		return -1;
+	}
+
+	// Cambia los fragmentos y diarios nuevos por los anteriores
+	Fragmento nombres;
+	for (int i = 0; i < k; i++) {
+		nombrarFragmento(&nombres, fileDatos, i, k);
+		snprintf(ruta, sizeof(ruta), "%s.nuevo", nombres.file_name);
+		if (access(ruta, F_OK) == 0 && rename(ruta, nombres.file_name) != 0) {
+			perror("No se pudo terminar el reparto del catalogo");
+			return -1;
+		}
+		snprintf(ruta, sizeof(ruta), "%s.nuevo", nombres.diario_name);
+		if (access(ruta, F_OK) == 0 && rename(ruta, nombres.diario_name) != 0) {
+			perror("No se pudo terminar el reparto del catalogo");
+			return -1;
+		}
+	}
+	if (sincronizarDirectorio(fileDatos) != 0) {
+		perror("No se pudo terminar el reparto del catalogo");
+		return -1;
+	}
+
+	// Elimina los fragmentos anteriores que ya no forman parte del catálogo
+	if (k == 1) {
+		for (int i = 0; existentes > 1 && i < existentes; i++) {
+			snprintf(ruta, sizeof(ruta), "%s.%d", fileDatos, i);
+			remove(ruta);
+			snprintf(ruta, sizeof(ruta), "%s.%d.diario", fileDatos, i);
+			remove(ruta);
+		}
+	} else {
+		for (int i = k; i < existentes; i++) {
+			snprintf(ruta, sizeof(ruta), "%s.%d", fileDatos, i);
+			remove(ruta);
+			snprintf(ruta, sizeof(ruta), "%s.%d.diario", fileDatos, i);
+			remove(ruta);
+		}
+		if (existentes == 1) {
+			snprintf(ruta, sizeof(ruta), "%s.diario", fileDatos);
+			remove(ruta);
+		}
+	}
+	remove(marca);
+	sincronizarDirectorio(fileDatos);
+	return 0;
+}
+
+// Función que reparte los libros de un catálogo (particionado o no) en k fragmentos. Los
+// fragmentos y diarios nuevos se escriben primero con nombre .nuevo; solo cuando todos están
+// en disco se anota la marca del reparto y se cambian por los anteriores. Si una escritura
+// falla (por ejemplo, con el disco lleno) el catálogo anterior queda intacto.
+int reparticionarCatalogo(const char *fileDatos, int k) {
+	if (completarReparto(fileDatos) != 0) {
+		return -1;
+	}
+	int existentes = contarFragmentos(fileDatos);
+	Fragmento todo = {0};
+
+	// Reúne los libros de todos los fragmentos actuales, con sus diarios aplicados
+	for (int i = 0; i < existentes; i++) {
+		Fragmento actual = {0};
+		nombrarFragmento(&actual, fileDatos, i, existentes);
+		if (cargarFragmento(&actual) != 0) {
+			liberarFragmento(&todo);
+			return -1;
+		}
+		for (int j = 0; j < actual.numLibros; j++) {
+			agregarLibro(&todo, &actual.libros[j]);
+		}
+		free(actual.libros);
+		free(actual.indice);
+	}
+
+	// Distribuye los libros en los nuevos fragmentos y los escribe con nombre temporal
+	numFragmentos = k;
+	for (int i = 0; i < k; i++) {
+		memset(&fragmentos[i], 0, sizeof(Fragmento));
+		nombrarFragmento(&fragmentos[i], fileDatos, i, k);
+	}
+	for (int j = 0; j < todo.numLibros; j++) {
+		agregarLibro(fragmentoDe(todo.libros[j].isbn), &todo.libros[j]);
+	}
+	free(todo.libros);
+
+	int resultado = 0;
+	char ruta[112];
+	for (int i = 0; i < k; i++) {
+		Fragmento *frag = &fragmentos[i];
+		if (resultado == 0) {
+			snprintf(ruta, sizeof(ruta), "%s.nuevo", frag->file_name);
+			resultado = escribirArchivo(ruta, frag->libros, frag->numLibros);
+		}
+		if (resultado == 0) {
+			snprintf(ruta, sizeof(ruta), "%s.nuevo", frag->diario_name);
+			resultado = crearDiario(ruta, i, k, frag->numLibros, contarEjemplares(frag->libros, frag->numLibros));
+		}
+		liberarFragmento(frag);
+	}
+	numFragmentos = 0;
+
+	// Con todos los fragmentos nuevos en disco se anota la marca: desde aquí el reparto se
+	// termina aunque el proceso se caiga
+	char marca[96];
+	snprintf(marca, sizeof(marca), "%s.reparto", fileDatos);
+	if (resultado == 0 && sincronizarDirectorio(fileDatos) == 0) {
+		FILE *archivo = fopen(marca, "w");
+		resultado = archivo == NULL || fprintf(archivo, "%d %d\n", k, existentes) < 0 ||
+		            fflush(archivo) != 0 || fsync(fileno(archivo)) != 0;
+		if (archivo != NULL && fclose(archivo) != 0) {
+			resultado = 1;
+		}
+		if (resultado == 0 && sincronizarDirectorio(fileDatos) != 0) {
+			resultado = 1;
+		}
+		if (resultado != 0) {
+			perror("No se pudo anotar el reparto del catalogo");
+			remove(marca);
+		}
+	} else {
+		resultado = -1;
+	}
+	if (resultado != 0) {
+		quitarRepartoNuevo(fileDatos, k);
+		fprintf(stderr, "Error: No se pudo reparticionar %s; el catalogo no cambio.\n", fileDatos);
+		return -1;
+	}
+
+	if (completarReparto(fileDatos) != 0) {
+		return -1;
+	}
+	printf("Catalogo %s reparticionado de %d a %d fragmentos\n", fileDatos, existentes, k);
+	return 0;
+}
+
+// Función que carga el catálogo en memoria e inicia un hilo de persistencia por fragmento
+int abrirCatalogo(const char *fileDatos, int k) {
+	// Un reparto interrumpido se termina antes de contar los fragmentos (el seguidor no
+	// modifica archivos: el principal lo termina al iniciar)
+	if (!seguidor && completarReparto(fileDatos) != 0) {
+		return -1;
+	}
+	int existentes = contarFragmentos(fileDatos);
+
+	// La cantidad de fragmentos se fija al crear el catálogo; cambiarla requiere -R
+	if (k != 0 && k != existentes) {
+		if (existentes != 1 || seguidor) {
+			fprintf(stderr, "Error: El catalogo tiene %d fragmentos; use -R para reparticionarlo.\n", existentes);
+			return -1;
+		}
+		if (reparticionarCatalogo(fileDatos, k) != 0) {
+			return -1;
+		}
+		existentes = k;
+	}
+
+	numFragmentos = existentes;
+
+	// Un archivo de fragmento de más (por ejemplo, de un reparto anterior) no se usa
+	char sobrante[96];
+	snprintf(sobrante, sizeof(sobrante), "%s.%d", fileDatos, numFragmentos == 1 ? 0 : numFragmentos);
+	if (access(sobrante, F_OK) == 0) {
+		fprintf(stderr, "Aviso: %s no forma parte del catalogo de %d fragmentos y no se usa.\n", sobrante, numFragmentos);
+	}
+	for (int i = 0; i < numFragmentos; i++) {
+		Fragmento *frag = &fragmentos[i];
+		memset(frag, 0, sizeof(Fragmento));
+		nombrarFragmento(frag, fileDatos, i, numFragmentos);
+
+		// El seguidor carga el fragmento siguiendo el diario del principal
+		if (seguidor) {
+			pthread_mutex_init(&frag->candado, NULL);
+			pthread_cond_init(&frag->cambios, NULL);
+			Vista *vieja;  // Al iniciar no hay una vista anterior
+			seguirFragmento(frag, &vieja);
+			if (frag->diario == NULL) {
+				fprintf(stderr, "Error: No se encontro el diario %s del principal.\n", frag->diario_name);
+				return -1;
+			}
+			if (verificarFragmento(frag) != 0) {
+				return -1;
+			}
+			continue;
+		}
+
+		if (cargarFragmento(frag) != 0 || verificarFragmento(frag) != 0) {
+			return -1;
+		}
+		publicarVista(frag);
+		frag->diario = fopen(frag->diario_name, "a");
+		if (frag->diario == NULL) {
+			perror("No se pudo abrir el diario");
+			return -1;
+		}
+		setvbuf(frag->diario, frag->bufferDiario, _IOFBF, sizeof(frag->bufferDiario));
+		struct stat info;
+		if (fstat(fileno(frag->diario), &info) == 0) {
+			frag->bytesDiario = info.st_size;  // Los cambios ya aplicados quedan antes de esta posición
+		}
+
+		// Un diario sin encabezado (catálogo nuevo o anterior a este registro) se reinicia con
+		// él después de guardar el fragmento, para que la cantidad de fragmentos quede anotada
+		int indice, registrados;
+		if (leerEncabezado(frag->diario_name, &indice, &registrados) != 0 &&
+		    (escribirLibros(frag->file_name, frag->libros, frag->numLibros) != 0 ||
+		     reiniciarDiario(frag, frag->bytesDiario, frag->numLibros, contarEjemplares(frag->libros, frag->numLibros)) != 0)) {
+			return -1;
+		}
+
+		// Preasigna las reservas de las listas de espera del fragmento
+		frag->reservas = (Reserva *)calloc(MAX_RESERVAS, sizeof(Reserva));
+		if (frag->reservas == NULL) {
+			perror("No se pudo reservar memoria para las listas de espera");
+			return -1;
+		}
+		for (int j = 0; j < MAX_RESERVAS; j++) {
+			frag->reservas[j].siguiente = frag->libres;
+			frag->libres = &frag->reservas[j];
+		}
+		pthread_mutex_init(&frag->candado, NULL);
+		pthread_mutex_init(&frag->candadoPunto, NULL);
+		pthread_cond_init(&frag->cambios, NULL);
+		pthread_create(&frag->hilo, NULL, persistirFragmento, frag);
+	}
+	if (seguidor) {
+		atomic_store(&pendienteDesde, 0);  // Los cambios leídos al cargar ya están aplicados
+		pthread_create(&hiloSeguidor, NULL, seguirCatalogo, NULL);
+	}
+	return 0;
+}
+
+// Función que detiene los hilos de persistencia, guardando los cambios pendientes
+void cerrarCatalogo() {
+	// Espera a que termine un ingreso en curso; los siguientes se cancelan (continuar es 0)
+	pthread_mutex_lock(&candadoIngreso);
+	pthread_mutex_unlock(&candadoIngreso);
+
+	if (seguidor) {
+		pthread_join(hiloSeguidor, NULL);
+	}
+	for (int i = 0; i < numFragmentos; i++) {
+		Fragmento *frag = &fragmentos[i];
+		if (!seguidor) {
+			pthread_mutex_lock(&frag->candado);
+			frag->terminar = 1;
+			pthread_cond_signal(&frag->cambios);
+			pthread_mutex_unlock(&frag->candado);
+			pthread_join(frag->hilo, NULL);
+		}
+
+		if (frag->diario != NULL) {
+			fclose(frag->diario);
+		}
+		pthread_mutex_destroy(&frag->candado);
+		if (!seguidor) {
+			pthread_mutex_destroy(&frag->candadoPunto);
+		}
+		pthread_cond_destroy(&frag->cambios);
+		liberarFragmento(frag);
+		liberarVista(atomic_exchange(&frag->vista, NULL));  // El hilo lector ya terminó
+	}
+}